@@ -3,10 +3,9 @@
 
 #include <immintrin.h>  // x86intrin
 #include <stdint.h>
+#include <ufomap/flat_hash_map.h>
 #include <ufomap/key.h>
 
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 namespace ufomap
@@ -101,6 +100,39 @@ public:
 		return splitBy3(key[0]) | (splitBy3(key[1]) << 1) | (splitBy3(key[2]) << 2);
 	}
 
+	/**
+	 * @brief Converts many keys at depth 0 to codes, four at a time with AVX2
+	 *
+	 * @param x The x components of the keys
+	 * @param y The y components of the keys
+	 * @param z The z components of the keys
+	 * @param codes Where the codes are written
+	 * @param num The number of keys
+	 */
+	static void toCodes(const KeyType* x, const KeyType* y, const KeyType* z,
+											uint64_t* codes, size_t num)
+	{
+		size_t i = 0;
+#if defined(__AVX2__)
+		for (; i + 4 <= num; i += 4)
+		{
+			__m256i cx = splitBy3(
+					_mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i))));
+			__m256i cy = splitBy3(
+					_mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + i))));
+			__m256i cz = splitBy3(
+					_mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(z + i))));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i),
+													_mm256_or_si256(_mm256_or_si256(cx, _mm256_slli_epi64(cy, 1)),
+																					_mm256_slli_epi64(cz, 2)));
+		}
+#endif
+		for (; i < num; ++i)
+		{
+			codes[i] = splitBy3(x[i]) | (splitBy3(y[i]) << 1) | (splitBy3(z[i]) << 2);
+		}
+	}
+
 	/**
 	 * @brief Get the key component from a code
 	 *
@@ -235,21 +267,22 @@ public:
 	}
 
 	/**
-	 * @brief
+	 * @brief Hash function for codes, mixes the Morton code so it can be used with
+	 * power of two sized hash tables
 	 *
 	 */
 	struct CodeHash
 	{
 		size_t operator()(const Code& code) const
 		{
-			return code.code_;
+			return mixHash(code.code_ ^ (static_cast<uint64_t>(code.depth_) << 59));
 		}
 	};
 
 private:
 	static uint64_t splitBy3(unsigned int a)
 	{
-#if defined(__BMI2__) || defined(__AVX2__)  // TODO: Is correct?
+#if defined(__BMI2__)
 		return _pdep_u64(static_cast<uint64_t>(a), 0x9249249249249249);
 #else
 		uint64_t code = static_cast<uint64_t>(a) & 0x1fffff;
@@ -262,9 +295,27 @@ private:
 #endif
 	}
 
+#if defined(__AVX2__)
+	static __m256i splitBy3(__m256i a)
+	{
+		__m256i code = _mm256_and_si256(a, _mm256_set1_epi64x(0x1fffff));
+		code = _mm256_and_si256(_mm256_or_si256(code, _mm256_slli_epi64(code, 32)),
+														_mm256_set1_epi64x(0x1f00000000ffff));
+		code = _mm256_and_si256(_mm256_or_si256(code, _mm256_slli_epi64(code, 16)),
+														_mm256_set1_epi64x(0x1f0000ff0000ff));
+		code = _mm256_and_si256(_mm256_or_si256(code, _mm256_slli_epi64(code, 8)),
+														_mm256_set1_epi64x(0x100f00f00f00f00f));
+		code = _mm256_and_si256(_mm256_or_si256(code, _mm256_slli_epi64(code, 4)),
+														_mm256_set1_epi64x(0x10c30c30c30c30c3));
+		code = _mm256_and_si256(_mm256_or_si256(code, _mm256_slli_epi64(code, 2)),
+														_mm256_set1_epi64x(0x1249249249249249));
+		return code;
+	}
+#endif
+
 	static unsigned int get3Bits(uint64_t code)
 	{
-#if defined(__BMI2__) || defined(__AVX2__)  // TODO: Is correct?
+#if defined(__BMI2__)
 		return static_cast<unsigned int>(_pext_u64(code, 0x9249249249249249));
 #else
 		uint64_t a = code & 0x1249249249249249;
@@ -284,9 +335,9 @@ private:
 	unsigned int depth_;
 };
 
-using CodeSet = std::unordered_set<Code, Code::CodeHash>;
+using CodeSet = FlatHashSet<Code, Code::CodeHash>;
 template <typename T>
-using CodeMap = std::unordered_map<Code, T, Code::CodeHash>;
+using CodeMap = FlatHashMap<Code, T, Code::CodeHash>;
 using CodeRay = std::vector<Code>;
 }  // namespace ufomap
 
@@ -0,0 +1,613 @@
+#ifndef UFOMAP_DEPTH_IMAGE_H
+#define UFOMAP_DEPTH_IMAGE_H
+
+#include <ufomap/geometry/intersects.h>
+#include <ufomap/math/pose6.h>
+#include <ufomap/point_cloud_soa.h>
+#include <ufomap/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace ufomap
+{
+/**
+ * @brief Pinhole camera model of a depth camera
+ *
+ * @details The camera frame has z forward, x to the right and y down in the image.
+ *
+ */
+struct CameraIntrinsics
+{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	float fx = 0;
+	float fy = 0;
+	float cx = 0;
+	float cy = 0;
+
+	CameraIntrinsics()
+	{
+	}
+
+	CameraIntrinsics(unsigned int width, unsigned int height, float fx, float fy, float cx,
+									 float cy)
+		: width(width), height(height), fx(fx), fy(fy), cx(cx), cy(cy)
+	{
+	}
+
+	/**
+	 * @return float The horizontal field of view (rad)
+	 */
+	float horizontalFov() const
+	{
+		return 2.0 * std::atan(std::max(cx, width - cx) / fx);
+	}
+
+	/**
+	 * @return float The vertical field of view (rad)
+	 */
+	float verticalFov() const
+	{
+		return 2.0 * std::atan(std::max(cy, height - cy) / fy);
+	}
+};
+
+/**
+ * @brief Beam layout of a rotating LiDAR producing an organized range image
+ *
+ * @details Row i of the range image holds the beam with elevation elevations[i] and
+ * column j is measured at azimuth azimuth_offset + j * 2pi / columns. Together the rows
+ * and columns tile the sphere between the lowest and highest beams, each beam covering
+ * half of the gap to its neighbors.
+ *
+ */
+struct LidarIntrinsics
+{
+	std::vector<float> elevations;  // Increasing elevation (rad) of each ring
+	unsigned int columns = 0;       // Number of measurements per revolution
+	float azimuth_offset = 0;       // Azimuth (rad) of the first column
+
+	LidarIntrinsics()
+	{
+	}
+
+	LidarIntrinsics(const std::vector<float>& elevations, unsigned int columns,
+									float azimuth_offset = 0)
+		: elevations(elevations), columns(columns), azimuth_offset(azimuth_offset)
+	{
+	}
+
+	unsigned int rings() const
+	{
+		return elevations.size();
+	}
+
+	float azimuthStep() const
+	{
+		return 2.0 * M_PI / columns;
+	}
+
+	/**
+	 * @return float The azimuth (rad) of a column
+	 */
+	float azimuth(unsigned int column) const
+	{
+		return azimuth_offset + (column * azimuthStep());
+	}
+};
+
+/**
+ * @brief Minimum and maximum depth of a depth image over rectangles of pixels
+ *
+ * @details Level 0 is the image itself and each level above halves the width and height.
+ * A query reads at most a few cells of the level where the rectangle is small, so the
+ * answer is conservative: the minimum can be smaller and the maximum larger than the
+ * actual ones in the rectangle.
+ *
+ */
+class DepthPyramid
+{
+public:
+	DepthPyramid()
+	{
+	}
+
+	/**
+	 * @brief Build the pyramid
+	 *
+	 * @param depth The depth (m) of each pixel, row by row. Pixels that are not finite or
+	 * not positive have no measurement.
+	 */
+	DepthPyramid(const std::vector<float>& depth, unsigned int width, unsigned int height)
+	{
+		build(depth, width, height);
+	}
+
+	/**
+	 * @brief Build the pyramid for a new depth image, reusing the memory of the last one
+	 *
+	 * @param depth The depth (m) of each pixel, row by row. Pixels that are not finite or
+	 * not positive have no measurement.
+	 */
+	void build(const std::vector<float>& depth, unsigned int width, unsigned int height)
+	{
+		size_t num_levels = 1;
+		for (unsigned int w = width, h = height; 1 < w || 1 < h; ++num_levels)
+		{
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+		levels_.resize(num_levels);
+
+		Level& base = levels_[0];
+		base.width = width;
+		base.height = height;
+		base.min.resize(depth.size());
+		base.max.resize(depth.size());
+		base.invalid.resize(depth.size());
+		for (size_t i = 0; i < depth.size(); ++i)
+		{
+			bool valid = std::isfinite(depth[i]) && 0 < depth[i];
+			base.min[i] = valid ? depth[i] : std::numeric_limits<float>::max();
+			base.max[i] = valid ? depth[i] : std::numeric_limits<float>::lowest();
+			base.invalid[i] = !valid;
+		}
+
+		for (size_t i = 1; i < num_levels; ++i)
+		{
+			const Level& prev = levels_[i - 1];
+			Level& level = levels_[i];
+			level.width = (prev.width + 1) / 2;
+			level.height = (prev.height + 1) / 2;
+			level.min.assign(level.width * level.height, std::numeric_limits<float>::max());
+			level.max.assign(level.width * level.height, std::numeric_limits<float>::lowest());
+			level.invalid.assign(level.width * level.height, false);
+			for (unsigned int v = 0; v < prev.height; ++v)
+			{
+				for (unsigned int u = 0; u < prev.width; ++u)
+				{
+					size_t from = (v * prev.width) + u;
+					size_t to = ((v / 2) * level.width) + (u / 2);
+					level.min[to] = std::min(level.min[to], prev.min[from]);
+					level.max[to] = std::max(level.max[to], prev.max[from]);
+					level.invalid[to] = level.invalid[to] || prev.invalid[from];
+				}
+			}
+		}
+	}
+
+	/**
+	 * @brief Get the depth range in the rectangle [u_min, u_max] x [v_min, v_max]
+	 *
+	 * @param min The minimum depth, max float if there are no measurements
+	 * @param max The maximum depth, lowest float if there are no measurements
+	 * @return true If there are pixels without measurement in the rectangle
+	 */
+	bool query(unsigned int u_min, unsigned int v_min, unsigned int u_max,
+						 unsigned int v_max, float& min, float& max) const
+	{
+		size_t level = 0;
+		while (level + 1 < levels_.size() &&
+					 (MAX_CELLS < ((u_max >> level) - (u_min >> level)) ||
+						MAX_CELLS < ((v_max >> level) - (v_min >> level))))
+		{
+			++level;
+		}
+
+		const Level& l = levels_[level];
+		min = std::numeric_limits<float>::max();
+		max = std::numeric_limits<float>::lowest();
+		bool invalid = false;
+		for (unsigned int v = v_min >> level; v <= (v_max >> level); ++v)
+		{
+			for (unsigned int u = u_min >> level; u <= (u_max >> level); ++u)
+			{
+				size_t index = (v * l.width) + u;
+				min = std::min(min, l.min[index]);
+				max = std::max(max, l.max[index]);
+				invalid = invalid || l.invalid[index];
+			}
+		}
+		return invalid;
+	}
+
+	/**
+	 * @brief Get the depth of a pixel
+	 *
+	 * @return float The depth, or a negative value if the pixel has no measurement
+	 */
+	float depth(unsigned int u, unsigned int v) const
+	{
+		size_t index = (v * levels_[0].width) + u;
+		return levels_[0].invalid[index] ? -1.0 : levels_[0].min[index];
+	}
+
+private:
+	// Number of cells, minus one, read along each axis by a query
+	static constexpr unsigned int MAX_CELLS = 3;
+
+	struct Level
+	{
+		unsigned int width;
+		unsigned int height;
+		std::vector<float> min;
+		std::vector<float> max;
+		std::vector<bool> invalid;
+	};
+
+	std::vector<Level> levels_;
+};
+
+/**
+ * @brief How much of an axis-aligned box a depth camera sees
+ *
+ */
+enum class Visibility
+{
+	// All of the box is in front of the measured depths
+	FREE,
+	// None of the box is in front of the measured depths
+	UNSEEN,
+	// Some of the box can be in front of the measured depths
+	PARTIAL
+};
+
+/**
+ * @brief A depth camera with a depth image, used to find free space by projection
+ *
+ */
+class ProjectiveCamera
+{
+public:
+	/**
+	 * @param pose The pose of the camera in the map
+	 * @param intrinsics The intrinsics of the camera
+	 * @param pyramid The depth image, with depths clipped to max_range. Has to outlive the
+	 * camera.
+	 * @param max_depth The largest depth in the depth image
+	 * @param max_range The maximum distance (m) from the camera, negative for no limit
+	 * @param near_distance The distance to the near plane of the frustum
+	 */
+	ProjectiveCamera(const ufomap_math::Pose6& pose, const CameraIntrinsics& intrinsics,
+									 const DepthPyramid& pyramid, float max_depth, float max_range,
+									 float near_distance)
+		: origin_(pose.translation()),
+			to_camera_(pose.inversed()),
+			intrinsics_(intrinsics),
+			pyramid_(pyramid),
+			max_range_(max_range)
+	{
+		// Frustum takes the ratio between the angles but uses it for the ratio between the
+		// tangents, so the horizontal angle is adjusted to get the correct width
+		float vertical_angle = intrinsics.verticalFov();
+		float horizontal_angle = vertical_angle * std::tan(intrinsics.horizontalFov() / 2.0) /
+														 std::tan(vertical_angle / 2.0);
+
+		RigidTransform to_map(pose);
+		frustum_ = ufomap_geometry::Frustum(
+				origin_, to_map(Point3(0, 0, 1)), to_map(Point3(0, -1, 0)) - origin_,
+				vertical_angle, horizontal_angle, near_distance,
+				std::max(near_distance, max_depth));
+
+		// A box with half size 1 in the map has these half sizes in the camera frame
+		const std::array<float, 9>& r = to_camera_.rotation();
+		for (size_t i = 0; i < 3; ++i)
+		{
+			extent_[i] = std::fabs(r[3 * i]) + std::fabs(r[(3 * i) + 1]) +
+									 std::fabs(r[(3 * i) + 2]);
+		}
+	}
+
+	/**
+	 * @brief Find how much of a cube is seen as free space
+	 *
+	 * @param center The center of the cube in the map
+	 * @param half_size Half the side length of the cube
+	 */
+	Visibility classify(const Point3& center, float half_size) const
+	{
+		if (0 <= max_range_ &&
+				origin_.distance(center) - (half_size * std::sqrt(3.0)) > max_range_)
+		{
+			return Visibility::UNSEEN;
+		}
+
+		Point3 half(half_size, half_size, half_size);
+		if (!ufomap_geometry::intersects(
+						frustum_, ufomap_geometry::AABB(center - half, center + half)))
+		{
+			return Visibility::UNSEEN;
+		}
+
+		// Bounding box in the camera frame
+		Point3 c = to_camera_(center);
+		Point3 e = extent_ * half_size;
+		float z_min = c[2] - e[2];
+		float z_max = c[2] + e[2];
+		if (0 >= z_min)
+		{
+			// Cannot be projected
+			return Visibility::PARTIAL;
+		}
+
+		// Bounding rectangle in the image
+		float u_min =
+				project(c[0] - e[0], z_min, z_max, false, intrinsics_.fx, intrinsics_.cx);
+		float u_max =
+				project(c[0] + e[0], z_min, z_max, true, intrinsics_.fx, intrinsics_.cx);
+		float v_min =
+				project(c[1] - e[1], z_min, z_max, false, intrinsics_.fy, intrinsics_.cy);
+		float v_max =
+				project(c[1] + e[1], z_min, z_max, true, intrinsics_.fy, intrinsics_.cy);
+		if (0 > u_max || intrinsics_.width <= u_min || 0 > v_max ||
+				intrinsics_.height <= v_min)
+		{
+			return Visibility::UNSEEN;
+		}
+		// Partly outside of the image, can still be unseen in the part inside
+		bool outside = 0 > u_min || intrinsics_.width <= u_max || 0 > v_min ||
+									 intrinsics_.height <= v_max;
+
+		float depth_min;
+		float depth_max;
+		bool invalid =
+				pyramid_.query(std::max(u_min, 0.0f), std::max(v_min, 0.0f),
+											 std::min(u_max, intrinsics_.width - 1.0f),
+											 std::min(v_max, intrinsics_.height - 1.0f), depth_min, depth_max);
+		if (z_min >= depth_max)
+		{
+			return Visibility::UNSEEN;
+		}
+		if (!outside && !invalid && z_max < depth_min)
+		{
+			// The depths are clipped to max range, so this is also inside max range
+			return Visibility::FREE;
+		}
+		return Visibility::PARTIAL;
+	}
+
+	/**
+	 * @brief Check if a point is in front of the depth of the pixel it projects onto
+	 *
+	 * @param point The point in the map
+	 */
+	bool isFree(const Point3& point) const
+	{
+		Point3 p = to_camera_(point);
+		if (0 >= p[2])
+		{
+			return false;
+		}
+		float u = (intrinsics_.fx * (p[0] / p[2])) + intrinsics_.cx;
+		float v = (intrinsics_.fy * (p[1] / p[2])) + intrinsics_.cy;
+		if (0 > u || intrinsics_.width <= u || 0 > v || intrinsics_.height <= v)
+		{
+			return false;
+		}
+		return p[2] < pyramid_.depth(u, v);
+	}
+
+private:
+	/**
+	 * @brief Smallest or largest image coordinate of a coordinate in the camera frame
+	 * over the depths [z_min, z_max]
+	 */
+	static float project(float coord, float z_min, float z_max, bool largest, float f,
+											 float c)
+	{
+		float at_min = coord / z_min;
+		float at_max = coord / z_max;
+		return (f * (largest ? std::max(at_min, at_max) : std::min(at_min, at_max))) + c;
+	}
+
+	Point3 origin_;
+	RigidTransform to_camera_;
+	CameraIntrinsics intrinsics_;
+	const DepthPyramid& pyramid_;
+	ufomap_geometry::Frustum frustum_;
+	Point3 extent_;
+	float max_range_;
+};
+
+/**
+ * @brief A rotating LiDAR with a range image, used to find free space by projection
+ *
+ * @details Works the same as ProjectiveCamera, except that the image is spherical and
+ * it is the range, not the depth, that is compared.
+ *
+ */
+class ProjectiveLidar
+{
+public:
+	/**
+	 * @param pose The pose of the LiDAR in the map
+	 * @param intrinsics The beam layout of the LiDAR
+	 * @param pyramid The range image, with ranges clipped to max_range. Has to outlive the
+	 * LiDAR.
+	 * @param max_range_image The largest range in the range image
+	 */
+	ProjectiveLidar(const ufomap_math::Pose6& pose, const LidarIntrinsics& intrinsics,
+									const DepthPyramid& pyramid, float max_range_image)
+		: to_lidar_(pose.inversed()),
+			intrinsics_(intrinsics),
+			pyramid_(pyramid),
+			max_range_image_(max_range_image)
+	{
+		// Each ring covers half the gap to its neighbors, there are at least two rings
+		const std::vector<float>& elevations = intrinsics.elevations;
+		size_t rings = elevations.size();
+		ring_bounds_.resize(rings + 1);
+		for (size_t i = 1; i < rings; ++i)
+		{
+			ring_bounds_[i] = (elevations[i - 1] + elevations[i]) / 2.0;
+		}
+		ring_bounds_[0] = (2.0 * elevations[0]) - ring_bounds_[1];
+		ring_bounds_[rings] = (2.0 * elevations[rings - 1]) - ring_bounds_[rings - 1];
+
+		const std::array<float, 9>& r = to_lidar_.rotation();
+		for (size_t i = 0; i < 3; ++i)
+		{
+			extent_[i] = std::fabs(r[3 * i]) + std::fabs(r[(3 * i) + 1]) +
+									 std::fabs(r[(3 * i) + 2]);
+		}
+	}
+
+	/**
+	 * @brief Find how much of a cube is seen as free space
+	 *
+	 * @param center The center of the cube in the map
+	 * @param half_size Half the side length of the cube
+	 */
+	Visibility classify(const Point3& center, float half_size) const
+	{
+		// Bounding box in the LiDAR frame
+		Point3 c = to_lidar_(center);
+		Point3 e = extent_ * half_size;
+		Point3 min = c - e;
+		Point3 max = c + e;
+
+		// Closest and furthest horizontal distance and range
+		float near_x = 0 < min[0] ? min[0] : (0 > max[0] ? max[0] : 0);
+		float near_y = 0 < min[1] ? min[1] : (0 > max[1] ? max[1] : 0);
+		float near_z = 0 < min[2] ? min[2] : (0 > max[2] ? max[2] : 0);
+		float far_x = std::max(std::fabs(min[0]), std::fabs(max[0]));
+		float far_y = std::max(std::fabs(min[1]), std::fabs(max[1]));
+		float far_z = std::max(std::fabs(min[2]), std::fabs(max[2]));
+		float rho_min = std::sqrt((near_x * near_x) + (near_y * near_y));
+		float rho_max = std::sqrt((far_x * far_x) + (far_y * far_y));
+		float range_min = std::sqrt((rho_min * rho_min) + (near_z * near_z));
+		float range_max = std::sqrt((rho_max * rho_max) + (far_z * far_z));
+
+		if (range_min >= max_range_image_)
+		{
+			// The ranges are clipped to max range, so this also handles max range
+			return Visibility::UNSEEN;
+		}
+
+		// Elevation interval
+		float elevation_min = std::atan2(min[2], 0 <= min[2] ? rho_max : rho_min);
+		float elevation_max = std::atan2(max[2], 0 <= max[2] ? rho_min : rho_max);
+		if (elevation_max < ring_bounds_.front() || elevation_min >= ring_bounds_.back())
+		{
+			return Visibility::UNSEEN;
+		}
+		// Partly outside of the field of view, can still be unseen in the part inside
+		bool outside =
+				elevation_min < ring_bounds_.front() || elevation_max >= ring_bounds_.back();
+		unsigned int ring_min = ring(elevation_min);
+		unsigned int ring_max = ring(elevation_max);
+
+		float range_lowest;
+		float range_highest;
+		bool invalid;
+		if (0 >= max[0] * min[0] && 0 >= max[1] * min[1])
+		{
+			// Contains the z-axis, so it covers all azimuths
+			outside = true;
+			invalid = pyramid_.query(0, ring_min, intrinsics_.columns - 1, ring_max,
+															 range_lowest, range_highest);
+		}
+		else
+		{
+			// Azimuth interval, less than pi wide since the z-axis is outside of the box
+			float azimuth_center = std::atan2(c[1], c[0]);
+			float azimuth_low = 0;
+			float azimuth_high = 0;
+			for (float x : {min[0], max[0]})
+			{
+				for (float y : {min[1], max[1]})
+				{
+					float diff = std::remainder(std::atan2(y, x) - azimuth_center, 2.0 * M_PI);
+					azimuth_low = std::min(azimuth_low, diff);
+					azimuth_high = std::max(azimuth_high, diff);
+				}
+			}
+			unsigned int column_min = column(azimuth_center + azimuth_low);
+			unsigned int column_max = column(azimuth_center + azimuth_high);
+
+			if (column_min <= column_max)
+			{
+				invalid = pyramid_.query(column_min, ring_min, column_max, ring_max,
+																 range_lowest, range_highest);
+			}
+			else
+			{
+				// Wraps around
+				float lowest;
+				float highest;
+				invalid = pyramid_.query(column_min, ring_min, intrinsics_.columns - 1, ring_max,
+																 range_lowest, range_highest);
+				invalid = pyramid_.query(0, ring_min, column_max, ring_max, lowest, highest) ||
+									invalid;
+				range_lowest = std::min(range_lowest, lowest);
+				range_highest = std::max(range_highest, highest);
+			}
+		}
+
+		if (range_min >= range_highest)
+		{
+			return Visibility::UNSEEN;
+		}
+		if (!outside && !invalid && range_max < range_lowest)
+		{
+			return Visibility::FREE;
+		}
+		return Visibility::PARTIAL;
+	}
+
+	/**
+	 * @brief Check if a point is in front of the range of the beam it projects onto
+	 *
+	 * @param point The point in the map
+	 */
+	bool isFree(const Point3& point) const
+	{
+		Point3 p = to_lidar_(point);
+		float range = p.norm();
+		float elevation = std::atan2(p[2], std::sqrt((p[0] * p[0]) + (p[1] * p[1])));
+		if (elevation < ring_bounds_.front() || elevation >= ring_bounds_.back())
+		{
+			return false;
+		}
+		return range < pyramid_.depth(column(std::atan2(p[1], p[0])), ring(elevation));
+	}
+
+private:
+	/**
+	 * @return unsigned int The ring whose beam covers the elevation
+	 */
+	unsigned int ring(float elevation) const
+	{
+		size_t index =
+				std::upper_bound(ring_bounds_.begin(), ring_bounds_.end(), elevation) -
+				ring_bounds_.begin();
+		return std::min(std::max(index, size_t(1)), ring_bounds_.size() - 1) - 1;
+	}
+
+	/**
+	 * @return unsigned int The column whose beam covers the azimuth
+	 */
+	unsigned int column(float azimuth) const
+	{
+		float step = intrinsics_.azimuthStep();
+		int index = std::floor((azimuth - intrinsics_.azimuth_offset) / step + 0.5);
+		index %= static_cast<int>(intrinsics_.columns);
+		return 0 > index ? index + intrinsics_.columns : index;
+	}
+
+	RigidTransform to_lidar_;
+	LidarIntrinsics intrinsics_;
+	const DepthPyramid& pyramid_;
+	std::vector<float> ring_bounds_;  // Lower elevation bound of each ring, then the upper
+	Point3 extent_;
+	float max_range_image_;
+};
+}  // namespace ufomap
+
+#endif  // UFOMAP_DEPTH_IMAGE_H
@@ -0,0 +1,596 @@
+#ifndef UFOMAP_FLAT_HASH_MAP_H
+#define UFOMAP_FLAT_HASH_MAP_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ufomap
+{
+/**
+ * @brief Mixes the bits of a 64 bit value, so that all input bits affect the lower bits
+ * of the result
+ *
+ * @details Morton codes and keys differ mostly in their lower bits and have long runs of
+ * zeros at coarser depths, which makes them bad hash values by themselves. This is the
+ * finalizer of SplitMix64.
+ *
+ * @param x The value to mix
+ * @return size_t The mixed value
+ */
+inline size_t mixHash(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return static_cast<size_t>(x ^ (x >> 31));
+}
+
+/**
+ * @brief An open-addressing hash table with linear probing
+ *
+ * @details All elements are stored in one contiguous array, with a separate array of
+ * flags indicating which slots are used. clear() keeps the memory, so a table that is
+ * filled and cleared repeatedly does not allocate once it has grown to its working size.
+ * Erase uses backward shift deletion, so there are no tombstones.
+ *
+ * @remark Inserting or erasing elements invalidates all iterators and references. The
+ * iterator returned by erase can be used to continue iterating, but an element whose
+ * probe sequence wraps around the end of the table may then be visited twice.
+ *
+ * @tparam SLOT The type stored in the table
+ * @tparam KEY The key type
+ * @tparam KEY_OF Function object returning the key of a slot
+ * @tparam HASH Hash function for the key, the lower bits of the result are used
+ * @tparam KEY_EQUAL Equality function for the key
+ */
+template <typename SLOT, typename KEY, typename KEY_OF, typename HASH, typename KEY_EQUAL>
+class FlatHashTable
+{
+public:
+	using key_type = KEY;
+	using value_type = SLOT;
+	using size_type = size_t;
+	using hasher = HASH;
+	using key_equal = KEY_EQUAL;
+
+	template <bool CONST>
+	class Iterator
+	{
+	public:
+		using difference_type = std::ptrdiff_t;
+		using value_type = SLOT;
+		using pointer = std::conditional_t<CONST, const SLOT*, SLOT*>;
+		using reference = std::conditional_t<CONST, const SLOT&, SLOT&>;
+		using iterator_category = std::forward_iterator_tag;
+
+		using table_pointer =
+				std::conditional_t<CONST, const FlatHashTable*, FlatHashTable*>;
+
+		Iterator()
+		{
+		}
+
+		Iterator(table_pointer table, size_t index) : table_(table), index_(index)
+		{
+		}
+
+		// Allow conversion from iterator to const_iterator
+		template <bool OTHER_CONST, typename = std::enable_if_t<CONST && !OTHER_CONST>>
+		Iterator(const Iterator<OTHER_CONST>& other)
+			: table_(other.table_), index_(other.index_)
+		{
+		}
+
+		reference operator*() const
+		{
+			return table_->slots_[index_];
+		}
+
+		pointer operator->() const
+		{
+			return &table_->slots_[index_];
+		}
+
+		// Prefix increment
+		Iterator& operator++()
+		{
+			index_ = table_->nextUsed(index_ + 1);
+			return *this;
+		}
+
+		// Postfix increment
+		Iterator operator++(int)
+		{
+			Iterator result = *this;
+			++(*this);
+			return result;
+		}
+
+		bool operator==(const Iterator& rhs) const
+		{
+			return index_ == rhs.index_ && table_ == rhs.table_;
+		}
+
+		bool operator!=(const Iterator& rhs) const
+		{
+			return !(*this == rhs);
+		}
+
+	private:
+		table_pointer table_ = nullptr;
+		size_t index_ = 0;
+
+		friend class FlatHashTable;
+		template <bool>
+		friend class Iterator;
+	};
+
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+
+public:
+	FlatHashTable()
+	{
+	}
+
+	FlatHashTable(size_t bucket_count)
+	{
+		reserve(bucket_count);
+	}
+
+	//
+	// Iterators
+	//
+
+	iterator begin()
+	{
+		return iterator(this, nextUsed(0));
+	}
+
+	const_iterator begin() const
+	{
+		return const_iterator(this, nextUsed(0));
+	}
+
+	const_iterator cbegin() const
+	{
+		return begin();
+	}
+
+	iterator end()
+	{
+		return iterator(this, slots_.size());
+	}
+
+	const_iterator end() const
+	{
+		return const_iterator(this, slots_.size());
+	}
+
+	const_iterator cend() const
+	{
+		return end();
+	}
+
+	//
+	// Capacity
+	//
+
+	bool empty() const
+	{
+		return 0 == size_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	/**
+	 * @return size_t The number of slots, used or not
+	 */
+	size_t bucket_count() const
+	{
+		return slots_.size();
+	}
+
+	float load_factor() const
+	{
+		return slots_.empty() ? 0.0 : static_cast<float>(size_) / slots_.size();
+	}
+
+	float max_load_factor() const
+	{
+		return max_load_factor_;
+	}
+
+	void max_load_factor(float ml)
+	{
+		max_load_factor_ = std::clamp(ml, 0.1f, 0.95f);
+		reserve(size_);
+	}
+
+	/**
+	 * @brief Make room for at least count elements without rehashing
+	 *
+	 * @param count The number of elements
+	 */
+	void reserve(size_t count)
+	{
+		size_t capacity = MIN_CAPACITY;
+		while (capacity * max_load_factor_ < count)
+		{
+			capacity *= 2;
+		}
+		if (capacity > slots_.size())
+		{
+			rehash(capacity);
+		}
+	}
+
+	//
+	// Modifiers
+	//
+
+	/**
+	 * @brief Erases all elements, but keeps the memory for reuse
+	 *
+	 */
+	void clear()
+	{
+		if (0 == size_)
+		{
+			return;
+		}
+
+		if constexpr (!std::is_trivially_destructible_v<SLOT>)
+		{
+			for (size_t i = 0; i < slots_.size(); ++i)
+			{
+				if (used_[i])
+				{
+					slots_[i] = SLOT();
+				}
+			}
+		}
+		std::memset(used_.data(), 0, used_.size());
+		size_ = 0;
+	}
+
+	iterator erase(const_iterator pos)
+	{
+		size_t index = pos.index_;
+		if (eraseIndex(index))
+		{
+			// An element was shifted into this slot
+			return iterator(this, index);
+		}
+		return iterator(this, nextUsed(index));
+	}
+
+	size_t erase(const KEY& key)
+	{
+		size_t index = findIndex(key);
+		if (slots_.size() == index)
+		{
+			return 0;
+		}
+		eraseIndex(index);
+		return 1;
+	}
+
+	void swap(FlatHashTable& other)
+	{
+		slots_.swap(other.slots_);
+		used_.swap(other.used_);
+		std::swap(size_, other.size_);
+		std::swap(max_load_factor_, other.max_load_factor_);
+		std::swap(hash_, other.hash_);
+		std::swap(equal_, other.equal_);
+	}
+
+	//
+	// Lookup
+	//
+
+	size_t count(const KEY& key) const
+	{
+		return slots_.size() == findIndex(key) ? 0 : 1;
+	}
+
+	iterator find(const KEY& key)
+	{
+		return iterator(this, findIndex(key));
+	}
+
+	const_iterator find(const KEY& key) const
+	{
+		return const_iterator(this, findIndex(key));
+	}
+
+protected:
+	/**
+	 * @brief Finds the slot for key, inserting a new element created from args if it does
+	 * not exist
+	 *
+	 * @return std::pair<iterator, bool> Iterator to the element and whether it was
+	 * inserted
+	 */
+	template <typename... Args>
+	std::pair<iterator, bool> emplaceKey(const KEY& key, Args&&... args)
+	{
+		size_t mask = slots_.size() - 1;
+		size_t index = hash_(key) & mask;
+		if (!slots_.empty())
+		{
+			while (used_[index])
+			{
+				if (equal_(KEY_OF()(slots_[index]), key))
+				{
+					return std::make_pair(iterator(this, index), false);
+				}
+				index = (index + 1) & mask;
+			}
+		}
+
+		if ((size_ + 1) > slots_.size() * max_load_factor_)
+		{
+			// key and args can refer to an element of this table, so the new element is
+			// created before the elements are moved
+			SLOT slot(std::forward<Args>(args)...);
+			rehash(std::max(MIN_CAPACITY, slots_.size() * 2));
+			mask = slots_.size() - 1;
+			index = hash_(KEY_OF()(slot)) & mask;
+			while (used_[index])
+			{
+				index = (index + 1) & mask;
+			}
+			slots_[index] = std::move(slot);
+		}
+		else
+		{
+			slots_[index] = SLOT(std::forward<Args>(args)...);
+		}
+		used_[index] = 1;
+		++size_;
+		return std::make_pair(iterator(this, index), true);
+	}
+
+	size_t findIndex(const KEY& key) const
+	{
+		if (0 == size_)
+		{
+			return slots_.size();
+		}
+
+		size_t mask = slots_.size() - 1;
+		size_t index = hash_(key) & mask;
+		while (used_[index])
+		{
+			if (equal_(KEY_OF()(slots_[index]), key))
+			{
+				return index;
+			}
+			index = (index + 1) & mask;
+		}
+		return slots_.size();
+	}
+
+	size_t nextUsed(size_t index) const
+	{
+		while (index < used_.size() && !used_[index])
+		{
+			++index;
+		}
+		return index;
+	}
+
+	/**
+	 * @brief Erase the element at index by shifting back the following elements of the
+	 * probe sequence
+	 *
+	 * @return true If an element was shifted into index
+	 */
+	bool eraseIndex(size_t index)
+	{
+		size_t mask = slots_.size() - 1;
+		size_t hole = index;
+		size_t current = index;
+		while (true)
+		{
+			current = (current + 1) & mask;
+			if (!used_[current])
+			{
+				break;
+			}
+			size_t ideal = hash_(KEY_OF()(slots_[current])) & mask;
+			// Move the element if its ideal slot is not cyclically in (hole, current]
+			if ((hole < current) ? (ideal <= hole || ideal > current) :
+														 (ideal <= hole && ideal > current))
+			{
+				slots_[hole] = std::move(slots_[current]);
+				hole = current;
+			}
+		}
+
+		slots_[hole] = SLOT();
+		used_[hole] = 0;
+		--size_;
+		return hole != index;
+	}
+
+	void rehash(size_t capacity)
+	{
+		std::vector<SLOT> old_slots(capacity);
+		std::vector<uint8_t> old_used(capacity, 0);
+		old_slots.swap(slots_);
+		old_used.swap(used_);
+
+		size_t mask = capacity - 1;
+		for (size_t i = 0; i < old_slots.size(); ++i)
+		{
+			if (old_used[i])
+			{
+				size_t index = hash_(KEY_OF()(old_slots[i])) & mask;
+				while (used_[index])
+				{
+					index = (index + 1) & mask;
+				}
+				slots_[index] = std::move(old_slots[i]);
+				used_[index] = 1;
+			}
+		}
+	}
+
+protected:
+	std::vector<SLOT> slots_;    // The elements, capacity is a power of two
+	std::vector<uint8_t> used_;  // Whether the slot with the same index is used
+	size_t size_ = 0;            // Number of elements
+	float max_load_factor_ = 0.75;
+	HASH hash_;
+	KEY_EQUAL equal_;
+
+	inline static const size_t MIN_CAPACITY = 16;
+};
+
+template <typename KEY>
+struct FlatHashSetKeyOf
+{
+	const KEY& operator()(const KEY& slot) const
+	{
+		return slot;
+	}
+};
+
+template <typename KEY, typename T>
+struct FlatHashMapKeyOf
+{
+	const KEY& operator()(const std::pair<KEY, T>& slot) const
+	{
+		return slot.first;
+	}
+};
+
+/**
+ * @brief Open-addressing hash set, see FlatHashTable
+ *
+ */
+template <typename KEY, typename HASH = std::hash<KEY>,
+					typename KEY_EQUAL = std::equal_to<KEY>>
+class FlatHashSet
+	: public FlatHashTable<KEY, KEY, FlatHashSetKeyOf<KEY>, HASH, KEY_EQUAL>
+{
+	using Base = FlatHashTable<KEY, KEY, FlatHashSetKeyOf<KEY>, HASH, KEY_EQUAL>;
+
+public:
+	using typename Base::const_iterator;
+	using typename Base::iterator;
+
+	using Base::Base;
+
+	std::pair<iterator, bool> insert(const KEY& key)
+	{
+		return this->emplaceKey(key, key);
+	}
+
+	template <typename InputIt>
+	void insert(InputIt first, InputIt last)
+	{
+		for (; first != last; ++first)
+		{
+			insert(*first);
+		}
+	}
+
+	std::pair<iterator, bool> emplace(const KEY& key)
+	{
+		return insert(key);
+	}
+};
+
+/**
+ * @brief Open-addressing hash map, see FlatHashTable
+ *
+ * @details Elements are stored as std::pair<KEY, T>. Changing the key of an element
+ * through an iterator is not allowed.
+ */
+template <typename KEY, typename T, typename HASH = std::hash<KEY>,
+					typename KEY_EQUAL = std::equal_to<KEY>>
+class FlatHashMap : public FlatHashTable<std::pair<KEY, T>, KEY, FlatHashMapKeyOf<KEY, T>,
+																				 HASH, KEY_EQUAL>
+{
+	using Base =
+			FlatHashTable<std::pair<KEY, T>, KEY, FlatHashMapKeyOf<KEY, T>, HASH, KEY_EQUAL>;
+
+public:
+	using mapped_type = T;
+	using typename Base::const_iterator;
+	using typename Base::iterator;
+
+	using Base::Base;
+
+	template <typename... Args>
+	std::pair<iterator, bool> try_emplace(const KEY& key, Args&&... args)
+	{
+		return this->emplaceKey(key, std::piecewise_construct, std::forward_as_tuple(key),
+														std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+
+	std::pair<iterator, bool> insert(const std::pair<KEY, T>& value)
+	{
+		return this->emplaceKey(value.first, value);
+	}
+
+	template <typename... Args>
+	std::pair<iterator, bool> emplace(const KEY& key, Args&&... args)
+	{
+		return try_emplace(key, std::forward<Args>(args)...);
+	}
+
+	template <typename M>
+	std::pair<iterator, bool> insert_or_assign(const KEY& key, M&& obj)
+	{
+		auto [it, inserted] = try_emplace(key, std::forward<M>(obj));
+		if (!inserted)
+		{
+			it->second = std::forward<M>(obj);
+		}
+		return std::make_pair(it, inserted);
+	}
+
+	T& operator[](const KEY& key)
+	{
+		return try_emplace(key).first->second;
+	}
+
+	T& at(const KEY& key)
+	{
+		iterator it = this->find(key);
+		if (this->end() == it)
+		{
+			throw std::out_of_range("FlatHashMap::at: key not found");
+		}
+		return it->second;
+	}
+
+	const T& at(const KEY& key) const
+	{
+		const_iterator it = this->find(key);
+		if (this->end() == it)
+		{
+			throw std::out_of_range("FlatHashMap::at: key not found");
+		}
+		return it->second;
+	}
+};
+}  // namespace ufomap
+
+#endif  // UFOMAP_FLAT_HASH_MAP_H
@@ -249,12 +249,13 @@ protected:
 
 			if (0 == child_depth)
 			{
-				node.node = &((*static_cast<std::array<LEAF_NODE, 8>*>(inner_node->children))[i]);
+				node.node =
+						&((*static_cast<std::array<LEAF_NODE, 8>*>(inner_node->getChildren()))[i]);
 			}
 			else
 			{
 				node.node =
-						&((*static_cast<std::array<INNER_NODE, 8>*>(inner_node->children))[i]);
+						&((*static_cast<std::array<INNER_NODE, 8>*>(inner_node->getChildren()))[i]);
 			}
 
 			if (validNode(node))
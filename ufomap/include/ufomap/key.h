@@ -3,12 +3,11 @@
 
 #include <immintrin.h>  // x86intrin
 #include <stdint.h>
+#include <ufomap/flat_hash_map.h>
 #include <ufomap/types.h>
 
 #include <array>
 #include <cstddef>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 namespace ufomap
@@ -150,24 +149,26 @@ public:
 	}
 
 	/**
-	 * @brief
+	 * @brief Hash function for keys, mixes the Morton code of the key so it can be used
+	 * with power of two sized hash tables
 	 *
 	 */
 	struct KeyHash
 	{
 		inline size_t operator()(const Key& key) const
 		{
-#if defined(__BMI2__) || defined(__AVX2__)  // TODO: Is correct?
-			return _pdep_u64(static_cast<uint64_t>(key[0]), 0x9249249249249249) |
-						 _pdep_u64(static_cast<uint64_t>(key[1]), 0x2492492492492492) |
-						 _pdep_u64(static_cast<uint64_t>(key[2]), 0x4924924924924924);
+#if defined(__BMI2__)
+			return mixHash(_pdep_u64(static_cast<uint64_t>(key[0]), 0x9249249249249249) |
+										 _pdep_u64(static_cast<uint64_t>(key[1]), 0x2492492492492492) |
+										 _pdep_u64(static_cast<uint64_t>(key[2]), 0x4924924924924924));
 #else
-			return splitBy3(key[0]) | (splitBy3(key[1]) << 1) | (splitBy3(key[2]) << 2);
+			return mixHash(splitBy3(key[0]) | (splitBy3(key[1]) << 1) |
+										 (splitBy3(key[2]) << 2));
 #endif
 		}
 
 	private:
-#if !defined(__BMI2__) && !defined(__AVX2__)  // TODO: Is correct?
+#if !defined(__BMI2__)
 		inline uint64_t splitBy3(unsigned int a) const
 		{
 			uint64_t code = static_cast<uint64_t>(a) & 0x1fffff;
@@ -188,9 +189,9 @@ private:
 	unsigned int depth_;
 };
 
-using KeySet = std::unordered_set<Key, Key::KeyHash>;
+using KeySet = FlatHashSet<Key, Key::KeyHash>;
 template <typename T>
-using KeyMap = std::unordered_map<Key, T, Key::KeyHash>;
+using KeyMap = FlatHashMap<Key, T, Key::KeyHash>;
 using KeyRay = std::vector<Key>;
 }  // namespace ufomap
 
@@ -0,0 +1,87 @@
+#ifndef UFOMAP_MATH_POSE_INTERPOLATOR_H
+#define UFOMAP_MATH_POSE_INTERPOLATOR_H
+
+#include <ufomap/math/pose6.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace ufomap_math
+{
+/**
+ * @brief Poses with timestamps, interpolated in between
+ *
+ * @details The translation is interpolated linearly and the rotation with slerp. Times
+ * before the first or after the last pose get the first or last pose.
+ *
+ */
+class PoseInterpolator
+{
+public:
+	/**
+	 * @brief Add a pose
+	 *
+	 * @param time The time of the pose, has to be later than the time of the last pose
+	 * @param pose The pose
+	 */
+	void add(double time, const Pose6& pose)
+	{
+		if (!poses_.empty() && time <= poses_.back().first)
+		{
+			throw std::invalid_argument("Poses have to be added in increasing time");
+		}
+		poses_.emplace_back(time, pose);
+	}
+
+	/**
+	 * @brief Get the pose at a time
+	 */
+	Pose6 operator()(double time) const
+	{
+		if (poses_.empty())
+		{
+			throw std::invalid_argument("PoseInterpolator has no poses");
+		}
+
+		auto it = std::upper_bound(
+				poses_.begin(), poses_.end(), time,
+				[](double time, const std::pair<double, Pose6>& pose) { return time < pose.first; });
+		if (poses_.begin() == it)
+		{
+			return poses_.front().second;
+		}
+		if (poses_.end() == it)
+		{
+			return poses_.back().second;
+		}
+
+		const auto& [time_0, pose_0] = *std::prev(it);
+		const auto& [time_1, pose_1] = *it;
+		float t = (time - time_0) / (time_1 - time_0);
+		return Pose6(pose_0.translation() + ((pose_1.translation() - pose_0.translation()) * t),
+								 pose_0.rotation().slerp(pose_1.rotation(), t));
+	}
+
+	size_t size() const
+	{
+		return poses_.size();
+	}
+
+	bool empty() const
+	{
+		return poses_.empty();
+	}
+
+	void clear()
+	{
+		poses_.clear();
+	}
+
+private:
+	std::vector<std::pair<double, Pose6>> poses_;
+};
+}  // namespace ufomap_math
+
+#endif  // UFOMAP_MATH_POSE_INTERPOLATOR_H
@@ -55,6 +55,15 @@ public:
 
 	Vector3 rotate(const Vector3& v) const;
 
+	/**
+	 * @brief Spherical linear interpolation, along the shortest path
+	 *
+	 * @param other The rotation at t = 1
+	 * @param t Interpolation parameter in [0, 1]
+	 * @return Quaternion The interpolated rotation
+	 */
+	Quaternion slerp(const Quaternion& other, float t) const;
+
 	const float& w() const;
 	float& w();
 	const float& x() const;
@@ -4,8 +4,12 @@
 #include <ufomap/code.h>
 #include <ufomap/color.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 
 // TODO: Update documentation
 
@@ -167,6 +171,121 @@ struct OccupancyNodeIntensity : OccupancyNode
 	}
 };
 
+/**
+ * @brief A logit stored as a fixed-point integer
+ *
+ * @details Converts to and from float, so it can be used in place of a float logit.
+ * Assigning a value outside of the range of T saturates at the min or max of T.
+ *
+ * @tparam T The signed integer type the logit is stored in
+ * @tparam SCALE The number of steps per unit of logit, a power of two so the stored
+ * values are exact as floats
+ */
+template <typename T, int SCALE>
+struct QuantizedLogit
+{
+	T value = 0;
+
+	QuantizedLogit()
+	{
+	}
+
+	QuantizedLogit(float logit) : value(quantize(logit))
+	{
+	}
+
+	QuantizedLogit& operator=(float logit)
+	{
+		value = quantize(logit);
+		return *this;
+	}
+
+	operator float() const
+	{
+		return value * (1.0f / SCALE);
+	}
+
+	/**
+	 * @brief Round a logit to the closest step, saturating at the range of T
+	 */
+	static T quantize(float logit)
+	{
+		float steps = std::clamp(logit * SCALE, float(std::numeric_limits<T>::min()),
+														 float(std::numeric_limits<T>::max()));
+		return static_cast<T>(0 <= steps ? steps + 0.5f : steps - 0.5f);
+	}
+};
+
+/**
+ * @brief An occupancy leaf node with the logit stored as a fixed-point integer. Reads and
+ * writes the same data as OccupancyNode.
+ *
+ * @tparam T The signed integer type the logit is stored in
+ * @tparam SCALE The number of steps per unit of logit
+ */
+template <typename T, int SCALE>
+struct QuantizedOccupancyNode
+{
+	// The occupancy value of the node
+	QuantizedLogit<T, SCALE> logit;
+
+	/**
+	 * @brief Write the data from this node to stream s
+	 *
+	 * @param s The stream to write the data to
+	 * @param is_occupied Whether this node is consider occupied
+	 * @param to_octomap Whether to write data in a UFOMap format or OctoMap format
+	 * @return std::ostream&
+	 */
+	std::ostream& writeData(std::ostream& s, float occupancy_thres_log,
+													float free_thres_log, bool to_octomap = false) const
+	{
+		if (to_octomap)
+		{
+			double value = logit;
+			s.write((const char*)&value, sizeof(value));
+		}
+		else
+		{
+			float value = logit;
+			s.write((const char*)&value, sizeof(value));
+		}
+		return s;
+	}
+
+	/**
+	 * @brief Read the data for this node from stream s
+	 *
+	 * @param s The stream to read the data from
+	 * @param is_occupied Whether this node is consider occupied
+	 * @param from_octomap Whether the data in the stream is in UFOMap format or OctoMap
+	 * format
+	 * @return std::istream&
+	 */
+	std::istream& readData(std::istream& s, float occupancy_thres_log, float free_thres_log,
+												 bool from_octomap = false)
+	{
+		if (from_octomap)
+		{
+			double value;
+			s.read((char*)&value, sizeof(value));
+			logit = value;
+		}
+		else
+		{
+			float value;
+			s.read((char*)&value, sizeof(value));
+			logit = value;
+		}
+		return s;
+	}
+};
+
+// Logits in [-4, 3.97] with a step of 1/32
+using OccupancyNodeQ8 = QuantizedOccupancyNode<int8_t, 32>;
+// Logits in [-32, 31.999] with a step of 1/1024
+using OccupancyNodeQ16 = QuantizedOccupancyNode<int16_t, 1024>;
+
 /**
  * @brief An inner node for the octree
  *
@@ -175,22 +294,84 @@ struct OccupancyNodeIntensity : OccupancyNode
 template <typename DATA_TYPE>
 struct InnerNode : DATA_TYPE
 {
-	// Important that the bools are before the children because of alignment on 64 bit
+	// Important that the flags are before the children because of alignment on 64 bit. The
+	// flags share one byte, which for most node types fits in the padding after DATA_TYPE
 
 	// Indicates whether this node or any of its children contains free space
-	bool contains_free = false;
+	bool contains_free : 1;
 	// Indicates whether this node or any of its children contains unknown space
-	bool contains_unknown = true;
-	// Indicates whether all of this children are the same. If this is true, there is no
-	// reason to visit its children
-	bool all_children_same = true;
+	bool contains_unknown : 1;
+	// Indicates whether all leaves under this node have the same logit as this node. Only
+	// meaningful while the node has children, a node without children is always uniform
+	bool uniform : 1;
+
+	InnerNode() : contains_free(false), contains_unknown(true), uniform(true)
+	{
+	}
+
+	InnerNode(const InnerNode& other)
+		: DATA_TYPE(other)
+		, contains_free(other.contains_free)
+		, contains_unknown(other.contains_unknown)
+		, uniform(other.uniform)
+		, children_(other.children_.load(std::memory_order_relaxed))
+	{
+	}
+
+	InnerNode& operator=(const InnerNode& rhs)
+	{
+		DATA_TYPE::operator=(rhs);
+		contains_free = rhs.contains_free;
+		contains_unknown = rhs.contains_unknown;
+		uniform = rhs.uniform;
+		children_.store(rhs.children_.load(std::memory_order_relaxed),
+										std::memory_order_relaxed);
+		return *this;
+	}
 
 	/**
-	 * @brief A pointer to the children of this node.
+	 * @brief Get a pointer to the children of this node.
 	 *
-	 * @remark You have to delete the children yourself
+	 * @remark The children are owned by the NodeAllocator of the octree
+	 */
+	void* getChildren() const
+	{
+		return reinterpret_cast<void*>(children_.load(std::memory_order_acquire) &
+																	 ~ALL_CHILDREN_SAME);
+	}
+
+	void setChildren(void* children)
+	{
+		children_.store(reinterpret_cast<uintptr_t>(children) |
+												(children_.load(std::memory_order_relaxed) & ALL_CHILDREN_SAME),
+										std::memory_order_release);
+	}
+
+	/**
+	 * @return true If all of the children are the same. If this is true, there is no
+	 * reason to visit its children
 	 */
-	void* children = nullptr;
+	bool allChildrenSame() const
+	{
+		return children_.load(std::memory_order_acquire) & ALL_CHILDREN_SAME;
+	}
+
+	void setAllChildrenSame(bool all_children_same)
+	{
+		uintptr_t children = children_.load(std::memory_order_relaxed) & ~ALL_CHILDREN_SAME;
+		children_.store(all_children_same ? children | ALL_CHILDREN_SAME : children,
+										std::memory_order_release);
+	}
+
+private:
+	// The children are at least 8 byte aligned, so the lowest bit of the pointer is free
+	// to store whether all children are the same. It is kept out of the flags above so it
+	// can be read and written atomically. Stores release and loads acquire, so a reader
+	// that sees the children, or that they are no longer all the same, also sees their
+	// initialized content
+	static constexpr uintptr_t ALL_CHILDREN_SAME = 1;
+
+	std::atomic<uintptr_t> children_{ ALL_CHILDREN_SAME };
 };
 
 /**
@@ -0,0 +1,407 @@
+#ifndef UFOMAP_NODE_ALLOCATOR_H
+#define UFOMAP_NODE_ALLOCATOR_H
+
+#include <ufomap/node.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace ufomap
+{
+/**
+ * @brief Slab allocator for blocks of type T.
+ *
+ * @details Memory is allocated BLOCKS_PER_SLAB blocks at a time. Deallocated blocks are
+ * put in a free list and reused by the next allocation, so splitting and pruning the
+ * same part of the tree over and over does not touch the heap. The memory is only given
+ * back with release() or when the pool is destroyed.
+ *
+ * @tparam T The type of the blocks
+ */
+template <typename T>
+class BlockPool
+{
+public:
+	static constexpr size_t BLOCKS_PER_SLAB = 256;
+
+public:
+	BlockPool()
+	{
+	}
+
+	BlockPool(const BlockPool& other) = delete;
+
+	BlockPool(BlockPool&& other) = default;
+
+	BlockPool& operator=(const BlockPool& other) = delete;
+
+	BlockPool& operator=(BlockPool&& other) = default;
+
+	/**
+	 * @brief Get a value-initialized block
+	 *
+	 * @return T* The block
+	 */
+	T* allocate()
+	{
+		if (nullptr == free_list_)
+		{
+			grow();
+		}
+
+		Slot* slot = free_list_;
+		free_list_ = slot->next;
+		++num_allocated_;
+		return new (slot->storage) T();
+	}
+
+	/**
+	 * @brief Give back a block that was gotten from allocate
+	 *
+	 * @param block The block
+	 */
+	void deallocate(T* block)
+	{
+		block->~T();
+		if (isOld(block))
+		{
+			// Given back all at once by endCompaction
+			--num_allocated_;
+			--num_old_allocated_;
+			return;
+		}
+		Slot* slot = reinterpret_cast<Slot*>(block);
+		slot->next = free_list_;
+		free_list_ = slot;
+		--num_allocated_;
+	}
+
+	/**
+	 * @brief Free all memory at once.
+	 *
+	 * @remark Blocks that are still allocated are not destructed and can no longer be used
+	 */
+	void release()
+	{
+		slabs_.clear();
+		old_slabs_.clear();
+		free_list_ = nullptr;
+		num_allocated_ = 0;
+	}
+
+	/**
+	 * @brief Start moving the blocks to new memory. Until endCompaction, blocks are only
+	 * allocated from new slabs and the blocks deallocated from the old slabs are not
+	 * reused.
+	 */
+	void beginCompaction()
+	{
+		old_slabs_.clear();
+		for (const auto& slab : slabs_)
+		{
+			old_slabs_.push_back(slab.get());
+		}
+		std::sort(old_slabs_.begin(), old_slabs_.end(), std::less<const Slot*>());
+		num_old_allocated_ = num_allocated_;
+		free_list_ = nullptr;
+	}
+
+	/**
+	 * @brief Free the old slabs, if all their blocks have been deallocated
+	 */
+	void endCompaction()
+	{
+		if (0 == num_old_allocated_)
+		{
+			// The new slabs were added after the old ones
+			slabs_.erase(slabs_.begin(), slabs_.begin() + old_slabs_.size());
+		}
+		old_slabs_.clear();
+	}
+
+	/**
+	 * @return true If block is in a slab from before beginCompaction
+	 */
+	bool isOld(const T* block) const
+	{
+		if (old_slabs_.empty())
+		{
+			return false;
+		}
+		const Slot* slot = reinterpret_cast<const Slot*>(block);
+		auto it = std::upper_bound(old_slabs_.begin(), old_slabs_.end(), slot,
+															 std::less<const Slot*>());
+		return old_slabs_.begin() != it &&
+					 std::less<const Slot*>()(slot, *std::prev(it) + BLOCKS_PER_SLAB);
+	}
+
+	/**
+	 * @return size_t Number of blocks that are allocated
+	 */
+	size_t numAllocated() const
+	{
+		return num_allocated_;
+	}
+
+	/**
+	 * @return size_t Number of blocks that can be allocated without growing
+	 */
+	size_t numFree() const
+	{
+		return (slabs_.size() * BLOCKS_PER_SLAB) - num_allocated_;
+	}
+
+	/**
+	 * @return size_t Memory used by the pool, including the free blocks
+	 */
+	size_t memoryUsage() const
+	{
+		return slabs_.size() * BLOCKS_PER_SLAB * sizeof(Slot);
+	}
+
+protected:
+	union Slot
+	{
+		Slot* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	void grow()
+	{
+		slabs_.push_back(std::make_unique<Slot[]>(BLOCKS_PER_SLAB));
+		Slot* slab = slabs_.back().get();
+		// Reversed so the blocks are handed out in address order
+		for (size_t i = BLOCKS_PER_SLAB; 0 < i; --i)
+		{
+			slab[i - 1].next = free_list_;
+			free_list_ = &slab[i - 1];
+		}
+	}
+
+protected:
+	std::vector<std::unique_ptr<Slot[]>> slabs_;
+	Slot* free_list_ = nullptr;
+	size_t num_allocated_ = 0;
+	// The slabs from before beginCompaction, sorted by address
+	std::vector<const Slot*> old_slabs_;
+	size_t num_old_allocated_ = 0;
+};
+
+/**
+ * @brief The eight children of an inner node.
+ *
+ * @details The children are shared between an octree and its copies until one of them
+ * changes them, ref_count is the number of inner nodes, in all octrees, pointing here.
+ *
+ * @tparam NODE The type of the children
+ */
+template <typename NODE>
+struct ChildBlock
+{
+	// Has to be first, the inner nodes point to it as std::array<NODE, 8>
+	std::array<NODE, 8> children;
+	std::atomic<uint32_t> ref_count{ 1 };
+};
+
+/**
+ * @brief Allocator for the children of the inner nodes of an octree.
+ *
+ * @details The children at depth 0 are stored in leaf blocks and all other children in
+ * inner blocks. The inner blocks have one pool per depth, which keeps nodes at the same
+ * depth close together in memory.
+ *
+ * @tparam LEAF_NODE The leaf node type of the octree
+ */
+template <typename LEAF_NODE>
+class NodeAllocator
+{
+public:
+	using LeafBlock = ChildBlock<LEAF_NODE>;
+	using InnerBlock = ChildBlock<InnerNode<LEAF_NODE>>;
+
+public:
+	NodeAllocator(unsigned int depth_levels)
+	{
+		inner_pools_.resize(depth_levels + 1);
+	}
+
+	/**
+	 * @brief Get children for an inner node at depth 1
+	 */
+	LeafBlock* allocateLeafBlock()
+	{
+		if (thread_safe_)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return leaf_pool_.allocate();
+		}
+		return leaf_pool_.allocate();
+	}
+
+	/**
+	 * @brief Get children for an inner node at depth
+	 *
+	 * @param depth The depth of the parent, has to be larger than 1
+	 */
+	InnerBlock* allocateInnerBlock(unsigned int depth)
+	{
+		if (thread_safe_)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return inner_pools_[depth].allocate();
+		}
+		return inner_pools_[depth].allocate();
+	}
+
+	void deallocate(LeafBlock* block)
+	{
+		if (thread_safe_)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			leaf_pool_.deallocate(block);
+		}
+		else
+		{
+			leaf_pool_.deallocate(block);
+		}
+	}
+
+	void deallocate(InnerBlock* block, unsigned int depth)
+	{
+		if (thread_safe_)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			inner_pools_[depth].deallocate(block);
+		}
+		else
+		{
+			inner_pools_[depth].deallocate(block);
+		}
+	}
+
+	//
+	// Compaction
+	//
+
+	/**
+	 * @brief Start moving the blocks to new memory. Until endCompaction, new blocks are
+	 * taken from new memory in the order they are allocated and the old memory is not
+	 * reused.
+	 */
+	void beginCompaction()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		leaf_pool_.beginCompaction();
+		for (auto& pool : inner_pools_)
+		{
+			pool.beginCompaction();
+		}
+		compacting_ = true;
+	}
+
+	/**
+	 * @brief Give back the old memory, all blocks in it have to be deallocated
+	 */
+	void endCompaction()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		leaf_pool_.endCompaction();
+		for (auto& pool : inner_pools_)
+		{
+			pool.endCompaction();
+		}
+		compacting_ = false;
+	}
+
+	bool isCompacting() const
+	{
+		return compacting_;
+	}
+
+	/**
+	 * @return true If the block has to be moved by the compaction
+	 */
+	bool isOld(const LeafBlock* block) const
+	{
+		return leaf_pool_.isOld(block);
+	}
+
+	/**
+	 * @param depth The depth of the parent of the block
+	 */
+	bool isOld(const InnerBlock* block, unsigned int depth) const
+	{
+		return inner_pools_[depth].isOld(block);
+	}
+
+	/**
+	 * @brief Make allocate and deallocate safe to call from several threads at once.
+	 *
+	 * @remark Has to be set while no other thread uses the allocator
+	 */
+	void setThreadSafe(bool thread_safe)
+	{
+		thread_safe_ = thread_safe;
+	}
+
+	bool isThreadSafe() const
+	{
+		return thread_safe_;
+	}
+
+	/**
+	 * @brief Free all memory at once, for example when the octree is cleared.
+	 *
+	 * @param depth_levels The new depth levels of the octree
+	 */
+	void release(unsigned int depth_levels)
+	{
+		leaf_pool_.release();
+		inner_pools_.clear();
+		inner_pools_.resize(depth_levels + 1);
+		compacting_ = false;
+	}
+
+	/**
+	 * @return size_t Memory used by the allocator, including the free blocks
+	 */
+	size_t memoryUsage() const
+	{
+		size_t usage = leaf_pool_.memoryUsage();
+		for (const auto& pool : inner_pools_)
+		{
+			usage += pool.memoryUsage();
+		}
+		return usage;
+	}
+
+	/**
+	 * @return size_t Memory in the free lists, that is ready to be reused
+	 */
+	size_t memoryFree() const
+	{
+		size_t usage = leaf_pool_.numFree() * sizeof(LeafBlock);
+		for (const auto& pool : inner_pools_)
+		{
+			usage += pool.numFree() * sizeof(InnerBlock);
+		}
+		return usage;
+	}
+
+protected:
+	BlockPool<LeafBlock> leaf_pool_;
+	std::vector<BlockPool<InnerBlock>> inner_pools_;
+	bool thread_safe_ = false;
+	bool compacting_ = false;
+	std::mutex mutex_;
+};
+}  // namespace ufomap
+
+#endif  // UFOMAP_NODE_ALLOCATOR_H
@@ -19,6 +19,15 @@ public:
 
 	Octree(const Octree& other);
 
+	/**
+	 * @brief Get a frozen copy of the octree in constant time. The copy shares its nodes
+	 * with this octree until this octree changes them.
+	 */
+	std::shared_ptr<const Octree> snapshot() const
+	{
+		return std::make_shared<const Octree>(*this);
+	}
+
 	virtual ~Octree()
 	{
 	}
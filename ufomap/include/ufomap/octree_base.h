@@ -2,28 +2,43 @@
 #define UFOMAP_OCTREE_BASE_H
 
 #include <ufomap/code.h>
+#include <ufomap/depth_image.h>
 #include <ufomap/iterator/leaf.h>
 #include <ufomap/iterator/tree.h>
 #include <ufomap/key.h>
+#include <ufomap/math/pose_interpolator.h>
 #include <ufomap/node.h>
+#include <ufomap/node_allocator.h>
 #include <ufomap/point_cloud.h>
+#include <ufomap/point_cloud_soa.h>
+#include <ufomap/radix_sort.h>
+#include <ufomap/ray_traversal.h>
 #include <ufomap/types.h>
 
 #include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <chrono>
 #include <cstring>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 // Compression
 #include <lz4.h>
 
 namespace ufomap
 {
+// Leaf nodes have an occupancy logit that converts to and from float
 template <typename LEAF_NODE,
-					typename = std::enable_if_t<std::is_base_of_v<OccupancyNode, LEAF_NODE>>>
+					typename = std::enable_if_t<
+							std::is_convertible_v<decltype(LEAF_NODE::logit), float> &&
+							std::is_assignable_v<decltype(LEAF_NODE::logit)&, float>>>
 class OctreeBase
 {
 public:
@@ -78,122 +93,487 @@ public:
 	void insertPointCloud(const Point3& sensor_origin, const PointCloud& cloud,
 												float max_range = -1)
 	{
-		computeUpdate(sensor_origin, cloud, max_range);
+		insertPointCloudImpl(sensor_origin, cloud, max_range);
+	}
 
-		// Insert
-		for (const auto& [code, value] : indices_)
+	void insertPointCloud(const Point3& sensor_origin, const PointCloudSoA& cloud,
+												float max_range = -1)
+	{
+		insertPointCloudImpl(sensor_origin, cloud, max_range);
+	}
+
+	/**
+	 * @brief Insert a point cloud where the points are merged into nodes at depth and the
+	 * rays are traced at that depth
+	 *
+	 * @details With n > 0 a ray switches to the next finer depth n nodes before its end,
+	 * down to depth 0. A miss at depth d has the logit prob_miss / (2d + 1), and a coarse
+	 * miss can contain hits of the same point cloud. With n = 0 and depth > 0 the hits are
+	 * integrated before the misses. Otherwise the hits and misses are applied together with
+	 * updateNodeValues, so a coarse miss is applied first and the hits inside of it last.
+	 * Before the updates were batched they were applied in hash map order, so which of the
+	 * two was applied last depended on the order of the hash map.
+	 *
+	 * @param sensor_origin The origin of the sensor
+	 * @param cloud The point cloud
+	 * @param max_range The maximum range (m) of the rays, negative for no limit
+	 * @param n The number of nodes before the end of a ray where it switches to the next
+	 * finer depth, 0 to trace the whole ray at depth
+	 * @param depth The depth the points are merged at
+	 */
+	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloud& cloud,
+																float max_range = -1, unsigned int n = 0,
+																unsigned int depth = 0)
+	{
+		insertPointCloudDiscreteImpl(sensor_origin, cloud, max_range, n, depth);
+	}
+
+	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloudSoA& cloud,
+																float max_range = -1, unsigned int n = 0,
+																unsigned int depth = 0)
+	{
+		insertPointCloudDiscreteImpl(sensor_origin, cloud, max_range, n, depth);
+	}
+
+	/**
+	 * @brief Insert a point cloud where the free space far away from the sensor is updated
+	 * at coarser depths.
+	 *
+	 * @details The rays are traced at depth 0 until depth_ranges[0] meters from the sensor,
+	 * at depth 1 until depth_ranges[1] meters, and so on. The rest of the rays are traced
+	 * at depth depth_ranges.size(). A miss at depth d updates the whole node at that depth
+	 * with the logit prob_miss / (2d + 1), the same as insertPointCloudDiscrete. Coarse
+	 * misses that contain a hit of the point cloud are skipped.
+	 *
+	 * @param sensor_origin The origin of the sensor
+	 * @param cloud The point cloud
+	 * @param depth_ranges Increasing distances (m) from the sensor where the rays switch to
+	 * the next depth, at most getTreeDepthLevels() - 1 of them
+	 * @param max_range The maximum range (m) of the rays, negative for no limit
+	 */
+	void insertPointCloudAdaptive(const Point3& sensor_origin, const PointCloud& cloud,
+																const std::vector<float>& depth_ranges,
+																float max_range = -1)
+	{
+		if (insert_session_active_)
+		{
+			throw std::invalid_argument("Cannot insert during an insert session");
+		}
+		if (depth_levels_ <= depth_ranges.size())
 		{
-			updateNodeValue(code, value);
+			throw std::invalid_argument("depth_ranges can have maximum depth_levels - 1 ranges");
+		}
+		if (!std::is_sorted(depth_ranges.begin(), depth_ranges.end()))
+		{
+			throw std::invalid_argument("depth_ranges has to be increasing");
 		}
 
-		indices_.clear();
+		if (depth_ranges.empty())
+		{
+			insertPointCloud(sensor_origin, cloud, max_range);
+			return;
+		}
+
+		CodeMap<float> concurrent_indices;
+		CodeMap<float>& indices = concurrency_enabled_ ? concurrent_indices : indices_;
+
+		if (concurrency_enabled_)
+		{
+			VisitedGrid visited;
+			computeUpdate(sensor_origin, cloud, 0, cloud.size(), max_range, depth_ranges,
+										indices, visited);
+		}
+		else
+		{
+			computeUpdate(sensor_origin, cloud, max_range, depth_ranges);
+		}
+
+		removeMissesContainingHits(indices, depth_ranges.size());
+
+		// Insert
+		updateNodeValues(indices.begin(), indices.end());
+		indices.clear();
+	}
+
+	void insertPointCloud(const Point3& sensor_origin, const PointCloud& cloud,
+												const Pose6& frame_origin, float max_range = -1)
+	{
+		// The points are transformed as they are read, the point cloud is not copied
+		insertPointCloudImpl(sensor_origin, TransformedPointCloud(cloud, frame_origin),
+												 max_range);
+	}
+
+	void insertPointCloud(const Point3& sensor_origin, const PointCloudSoA& cloud,
+												const Pose6& frame_origin, float max_range = -1)
+	{
+		insertPointCloudImpl(sensor_origin, TransformedPointCloud(cloud, frame_origin),
+												 max_range);
 	}
 
 	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloud& cloud,
-																float max_range = -1, unsigned int n = 0,
-																unsigned int depth = 0)
+																const Pose6& frame_origin, float max_range = -1,
+																unsigned int n = 0, unsigned int depth = 0)
 	{
-		KeyMap<std::vector<Key>> discrete_map;
+		insertPointCloudDiscreteImpl(
+				sensor_origin, TransformedPointCloud(cloud, frame_origin), max_range, n, depth);
+	}
 
-		std::vector<Key> discrete;
+	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloudSoA& cloud,
+																const Pose6& frame_origin, float max_range = -1,
+																unsigned int n = 0, unsigned int depth = 0)
+	{
+		insertPointCloudDiscreteImpl(
+				sensor_origin, TransformedPointCloud(cloud, frame_origin), max_range, n, depth);
+	}
 
-		KeySet temp;
-		Point3 origin;
-		Point3 end;
-		float distance;
-		Point3 dir;
-		Key changed_end;
-		Point3 changed_point;
-		Key point_key;
-		for (const Point3& point : cloud)
+	/**
+	 * @brief Insert a point cloud where each point has its own sensor origin, e.g. a
+	 * motion compensated LiDAR sweep.
+	 *
+	 * @details All rays are traced and merged in one pass and the map is updated once, the
+	 * same as insertPointCloud with a single sensor origin.
+	 *
+	 * @param sensor_origins The sensor origin of each point
+	 * @param cloud The point cloud
+	 * @param max_range The maximum range (m) of the rays, negative for no limit
+	 */
+	void insertPointCloud(const std::vector<Point3>& sensor_origins, const PointCloud& cloud,
+												float max_range = -1)
+	{
+		if (sensor_origins.size() != cloud.size())
+		{
+			throw std::invalid_argument("There has to be one sensor origin per point");
+		}
+		insertPointCloudImpl(sensor_origins, cloud, max_range);
+	}
+
+	void insertPointCloud(const std::vector<Point3>& sensor_origins,
+												const PointCloudSoA& cloud, float max_range = -1)
+	{
+		if (sensor_origins.size() != cloud.size())
 		{
-			point_key = coordToKey(static_cast<const Point3&>(point), 0);
-			if (temp.insert(point_key).second)
+			throw std::invalid_argument("There has to be one sensor origin per point");
+		}
+		insertPointCloudImpl(sensor_origins, cloud, max_range);
+	}
+
+	/**
+	 * @brief Deskew and insert a point cloud that was measured while the sensor moved.
+	 *
+	 * @details Each point is transformed with the sensor pose at its timestamp and traced
+	 * from the sensor position at that time. The pose is only interpolated when the
+	 * timestamp changes, so points measured together (e.g. a LiDAR packet) can share one
+	 * timestamp.
+	 *
+	 * @param cloud The point cloud in the sensor frame
+	 * @param timestamps The time each point was measured
+	 * @param sensor_poses The pose of the sensor in the map over the time of the cloud
+	 * @param max_range The maximum range (m) of the rays, negative for no limit
+	 */
+	void insertPointCloud(const PointCloud& cloud, const std::vector<double>& timestamps,
+												const PoseInterpolator& sensor_poses, float max_range = -1)
+	{
+		if (timestamps.size() != cloud.size())
+		{
+			throw std::invalid_argument("There has to be one timestamp per point");
+		}
+
+		std::vector<Point3> sensor_origins;
+		sensor_origins.reserve(cloud.size());
+		PointCloudSoA deskewed;
+		deskewed.reserve(cloud.size());
+		for (size_t i = 0; i < cloud.size();)
+		{
+			// All points with the same timestamp use the same pose
+			RigidTransform transform(sensor_poses(timestamps[i]));
+			size_t last = i + 1;
+			while (last < cloud.size() && timestamps[i] == timestamps[last])
 			{
-				changed_point = keyToCoord(point_key, 0);
+				++last;
+			}
+			for (; i < last; ++i)
+			{
+				deskewed.push_back(transform(cloud[i]));
+				sensor_origins.push_back(transform.translation());
+			}
+		}
 
-				origin = sensor_origin;
-				end = changed_point - origin;
-				distance = end.norm();
-				dir = end / distance;
-				if (0 <= max_range && distance > max_range)
-				{
-					end = origin + (dir * max_range);
-				}
-				else
-				{
-					end = changed_point;
-				}
+		insertPointCloudImpl(sensor_origins, deskewed, max_range);
+	}
+
+	//
+	// Streaming insertion
+	//
+
+	/**
+	 * @brief Start an insert session, where point clouds (e.g. LiDAR packets) are ray traced
+	 * as they arrive with addPointCloud and applied to the octree together by commitInsert.
+	 *
+	 * @details Without a point budget the result is identical to one insertPointCloud with
+	 * all of the points, while the ray tracing is spread over the calls to addPointCloud.
+	 * The session uses the same buffer as the other insertion functions, so those, clear
+	 * and enableConcurrency throw until the session is committed. Cannot be used with
+	 * concurrency enabled.
+	 *
+	 * @param point_budget Commit automatically once this many points have been added since
+	 * the last commit, 0 to only commit with commitInsert
+	 */
+	void beginInsert(size_t point_budget = 0)
+	{
+		if (concurrency_enabled_)
+		{
+			throw std::invalid_argument("Insert sessions cannot be used with concurrency");
+		}
+		if (insert_session_active_)
+		{
+			throw std::invalid_argument("An insert session is already active");
+		}
+		insert_session_active_ = true;
+		insert_session_budget_ = point_budget;
+		insert_session_points_ = 0;
+	}
+
+	/**
+	 * @brief Ray trace a point cloud in the active insert session
+	 *
+	 * @param sensor_origin The origin of the sensor
+	 * @param cloud The point cloud
+	 * @param max_range The maximum range (m) of the rays, negative for no limit
+	 */
+	void addPointCloud(const Point3& sensor_origin, const PointCloud& cloud,
+										 float max_range = -1)
+	{
+		addPointCloudImpl(sensor_origin, cloud, max_range);
+	}
+
+	void addPointCloud(const Point3& sensor_origin, const PointCloudSoA& cloud,
+										 float max_range = -1)
+	{
+		addPointCloudImpl(sensor_origin, cloud, max_range);
+	}
+
+	void addPointCloud(const std::vector<Point3>& sensor_origins, const PointCloud& cloud,
+										 float max_range = -1)
+	{
+		if (sensor_origins.size() != cloud.size())
+		{
+			throw std::invalid_argument("There has to be one sensor origin per point");
+		}
+		addPointCloudImpl(sensor_origins, cloud, max_range);
+	}
+
+	/**
+	 * @brief Apply everything added since the last commit and end the insert session
+	 */
+	void commitInsert()
+	{
+		if (!insert_session_active_)
+		{
+			throw std::invalid_argument("No insert session is active");
+		}
+		applyInsertSession();
+		insert_session_active_ = false;
+	}
+
+	bool isInsertSessionActive() const
+	{
+		return insert_session_active_;
+	}
+
+	/**
+	 * @return size_t The number of points added since the last commit
+	 */
+	size_t getInsertSessionPoints() const
+	{
+		return insert_session_points_;
+	}
+
+	/**
+	 * @brief Insert a depth image by projecting the nodes in the camera frustum into the
+	 * image, instead of casting a ray for each pixel.
+	 *
+	 * @details Starting at the root, each node in the frustum is projected into the image.
+	 * A node in front of all depths in its part of the image is free and gets a single
+	 * prob_miss update at its own depth. This is not the same as updating each voxel inside
+	 * of it: if the node is not occupied afterwards its children are deleted, so the whole
+	 * node gets the occupancy of its most occupied child plus prob_miss, and unknown space
+	 * inside of it becomes free. A node behind all depths is not seen and is skipped. The
+	 * remaining nodes, and nodes that are only partly in the image or in front of pixels
+	 * without depth, are split. A voxel is free if its center projects onto a pixel with a
+	 * larger depth, so a voxel that a ray passes through but whose center projects onto
+	 * another pixel can get a different update than with insertPointCloud. Each pixel with
+	 * a depth gives a hit in the voxel containing the point.
+	 *
+	 * @param pose The pose of the camera in the map, with z forward, x to the right and y
+	 * down in the image
+	 * @param intrinsics The intrinsics of the camera
+	 * @param depth The depth of each pixel, row by row. Zero, negative and non-finite
+	 * values have no measurement.
+	 * @param max_range The maximum distance (m) from the camera, negative for no limit.
+	 * Pixels further away give free space until max_range but no hit.
+	 * @param depth_scale Multiplied with the depth values to get meters, e.g. 0.001 for
+	 * 16-bit depth in millimeters
+	 */
+	template <typename DEPTH>
+	void insertDepthImage(const Pose6& pose, const CameraIntrinsics& intrinsics,
+												const DEPTH* depth, float max_range = -1, float depth_scale = 1)
+	{
+		if (insert_session_active_)
+		{
+			throw std::invalid_argument("Cannot insert during an insert session");
+		}
+		if (0 == intrinsics.width || 0 == intrinsics.height || 0 >= intrinsics.fx ||
+				0 >= intrinsics.fy)
+		{
+			throw std::invalid_argument("Camera intrinsics are not valid");
+		}
 
-				// Move origin and end to inside BBX
-				if (!moveLineIntoBBX(origin, end))
+		CodeMap<float> concurrent_indices;
+		CodeMap<float>& indices = concurrency_enabled_ ? concurrent_indices : indices_;
+		std::vector<float> concurrent_clipped;
+		std::vector<float>& clipped = concurrency_enabled_ ? concurrent_clipped : clipped_;
+		DepthPyramid concurrent_pyramid;
+		DepthPyramid& pyramid = concurrency_enabled_ ? concurrent_pyramid : pyramid_;
+
+		// Hits, and the depths clipped to max_range that are used for free space
+		RigidTransform camera_to_map(pose);
+		clipped.resize(intrinsics.width * intrinsics.height);
+		float max_depth = 0;
+		for (unsigned int v = 0; v < intrinsics.height; ++v)
+		{
+			for (unsigned int u = 0; u < intrinsics.width; ++u)
+			{
+				size_t index = (v * intrinsics.width) + u;
+				float z = depth_scale * static_cast<float>(depth[index]);
+				if (!std::isfinite(z) || 0 >= z)
 				{
-					// Line outside of BBX
+					clipped[index] = -1;
 					continue;
 				}
 
-				changed_end = coordToKey(end, 0);
-				if (changed_point == end)
+				Point3 point((((u + 0.5) - intrinsics.cx) / intrinsics.fx) * z,
+										 (((v + 0.5) - intrinsics.cy) / intrinsics.fy) * z, z);
+				float distance = point.norm();
+				if (0 <= max_range && distance > max_range)
 				{
-					if (0 == n && 0 != depth)  // TODO: Why 0 == depth? Should it not be 0 !=
-																		 // depth
-					{
-						integrateHit(Code(changed_end));
-					}
-					else if (!indices_.try_emplace(changed_end, prob_hit_log_).second)
+					z *= max_range / distance;
+				}
+				else
+				{
+					Point3 end = camera_to_map(point);
+					if (inBBX(end))
 					{
-						continue;
+						indices[Code(coordToKey(end, 0))] = prob_hit_log_;
 					}
 				}
-
-				discrete.push_back(changed_end);
+				clipped[index] = z;
+				max_depth = std::max(max_depth, z);
 			}
 		}
-		if (0 != depth)
+
+		if (0 < max_depth)
+		{
+			// Free space
+			pyramid.build(clipped, intrinsics.width, intrinsics.height);
+			ProjectiveCamera camera(pose, intrinsics, pyramid, max_depth, max_range,
+															0.1 * getResolution());
+			computeUpdateProjective(camera, Code(0, depth_levels_), indices);
+		}
+
+		// Insert
+		updateNodeValues(indices.begin(), indices.end());
+		indices.clear();
+	}
+
+	/**
+	 * @brief Insert an organized scan from a rotating LiDAR by projecting the nodes into
+	 * the spherical range image, instead of casting a ray for each beam.
+	 *
+	 * @details The same as insertDepthImage. Neighboring beams cover a contiguous solid
+	 * angle, so a coarse node in front of all ranges in its part of the image gets a single
+	 * update at its own depth, with the same collapsing of its children. Far from the
+	 * LiDAR, where the beams diverge, the number of nodes visited is much lower than the
+	 * number of voxels the rays pass through.
+	 *
+	 * @param pose The pose of the LiDAR in the map, with x at azimuth 0 and z up
+	 * @param intrinsics The beam layout of the LiDAR
+	 * @param range The range of each beam, row by row with one row per ring. Zero, negative
+	 * and non-finite values have no return.
+	 * @param max_range The maximum distance (m) from the LiDAR, negative for no limit.
+	 * Beams further away give free space until max_range but no hit.
+	 * @param range_scale Multiplied with the range values to get meters
+	 */
+	template <typename RANGE>
+	void insertRangeImage(const Pose6& pose, const LidarIntrinsics& intrinsics,
+												const RANGE* range, float max_range = -1, float range_scale = 1)
+	{
+		if (insert_session_active_)
+		{
+			throw std::invalid_argument("Cannot insert during an insert session");
+		}
+		if (2 > intrinsics.rings() || 0 == intrinsics.columns ||
+				!std::is_sorted(intrinsics.elevations.begin(), intrinsics.elevations.end()))
 		{
-			std::vector<Key> previous;
-			for (unsigned int d = (0 == n ? depth : 1); d <= depth; ++d)
+			throw std::invalid_argument(
+					"LiDAR intrinsics need columns and at least two increasing elevations");
+		}
+
+		CodeMap<float> concurrent_indices;
+		CodeMap<float>& indices = concurrency_enabled_ ? concurrent_indices : indices_;
+		std::vector<float> concurrent_clipped;
+		std::vector<float>& clipped = concurrency_enabled_ ? concurrent_clipped : clipped_;
+		DepthPyramid concurrent_pyramid;
+		DepthPyramid& pyramid = concurrency_enabled_ ? concurrent_pyramid : pyramid_;
+
+		// Hits, and the ranges clipped to max_range that are used for free space
+		RigidTransform lidar_to_map(pose);
+		clipped.resize(intrinsics.rings() * intrinsics.columns);
+		float max_range_image = 0;
+		for (unsigned int ring = 0; ring < intrinsics.rings(); ++ring)
+		{
+			float elevation = intrinsics.elevations[ring];
+			for (unsigned int column = 0; column < intrinsics.columns; ++column)
 			{
-				previous.swap(discrete);
-				discrete.clear();
-				for (const Key& key : previous)
+				size_t index = (ring * intrinsics.columns) + column;
+				float r = range_scale * static_cast<float>(range[index]);
+				if (!std::isfinite(r) || 0 >= r)
+				{
+					clipped[index] = -1;
+					continue;
+				}
+
+				if (0 <= max_range && r > max_range)
+				{
+					r = max_range;
+				}
+				else
 				{
-					Key key_at_depth = Code(key).toDepth(d).toKey();
-					std::vector<Key>& key_at_depth_children = discrete_map[key_at_depth];
-					if (key_at_depth_children.empty())
+					float azimuth = intrinsics.azimuth(column);
+					float rho = r * std::cos(elevation);
+					Point3 point(rho * std::cos(azimuth), rho * std::sin(azimuth),
+											 r * std::sin(elevation));
+					Point3 end = lidar_to_map(point);
+					if (inBBX(end))
 					{
-						discrete.push_back(key_at_depth);
+						indices[Code(coordToKey(end, 0))] = prob_hit_log_;
 					}
-					key_at_depth_children.push_back(key);
 				}
+				clipped[index] = r;
+				max_range_image = std::max(max_range_image, r);
 			}
 		}
 
-		computeUpdateDiscrete(sensor_origin, discrete, discrete_map, n);
-
-		// Insert
-		for (const auto& [code, value] : indices_)
+		if (0 < max_range_image)
 		{
-			updateNodeValue(code, value);
+			// Free space
+			pyramid.build(clipped, intrinsics.columns, intrinsics.rings());
+			ProjectiveLidar lidar(pose, intrinsics, pyramid, max_range_image);
+			computeUpdateProjective(lidar, Code(0, depth_levels_), indices);
 		}
-		indices_.clear();
-	}
-
-	void insertPointCloud(const Point3& sensor_origin, const PointCloud& cloud,
-												const Pose6& frame_origin, float max_range = -1)
-	{
-		PointCloud cloud_transformed(cloud);
-		cloud_transformed.transform(frame_origin);
-		insertPointCloud(sensor_origin, cloud_transformed, max_range);
-	}
 
-	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloud& cloud,
-																const Pose6& frame_origin, float max_range = -1,
-																unsigned int n = 0, unsigned int depth = 0)
-	{
-		PointCloud cloud_transformed(cloud);
-		cloud_transformed.transform(frame_origin);
-		insertPointCloudDiscrete(sensor_origin, cloud_transformed, max_range, n, depth);
+		// Insert
+		updateNodeValues(indices.begin(), indices.end());
+		indices.clear();
 	}
 
 	//
@@ -283,12 +663,86 @@ public:
 
 		computeRayInit(origin, end, direction, current, ending, step, t_delta, t_max, depth);
 
+		if (current == ending)
+		{
+			return;
+		}
+
 		// Increment
-		while (current != ending && t_max.min() <= max_range)
+		RayBatch rays;
+		rays.add(current, ending, step, t_delta, t_max, max_range);
+		rays.traverse([&ray](size_t, const Key& key) { ray.push_back(key); });
+	}
+
+	/**
+	 * @brief Compute the rays from origin to each of the ends. The rays are traversed
+	 * RayBatch::SIZE at a time.
+	 *
+	 * @param origin The start of all rays
+	 * @param ends The ends of the rays
+	 * @param rays The resulting rays, one for each end
+	 * @param max_range The maximum range of the rays
+	 * @param depth The depth of the keys in the rays
+	 */
+	void computeRays(const Point3& origin, const std::vector<Point3>& ends,
+									 std::vector<KeyRay>& rays, float max_range = -1,
+									 unsigned int depth = 0) const
+	{
+		rays.resize(ends.size());
+
+		RayBatch batch;
+		std::array<size_t, RayBatch::SIZE> batch_index;
+
+		auto traverse = [&batch, &batch_index, &rays]() {
+			batch.traverse([&batch_index, &rays](size_t index, const Key& key) {
+				rays[batch_index[index]].push_back(key);
+			});
+			batch.clear();
+		};
+
+		for (size_t i = 0; i < ends.size(); ++i)
 		{
-			ray.push_back(current);
-			computeRayTakeStep(current, step, t_delta, t_max, depth);
+			Point3 current_origin = origin;
+			Point3 end = ends[i];
+
+			Point3 direction = (end - current_origin).normalize();
+
+			if (0 <= max_range && max_range < current_origin.distance(end))
+			{
+				end = current_origin + (direction * max_range);
+			}
+
+			// Move origin and end to inside BBX
+			if (!moveLineIntoBBX(current_origin, end))
+			{
+				// Line outside of BBX
+				continue;
+			}
+
+			Key current;
+			Key ending;
+
+			std::array<int, 3> step;
+			Point3 t_delta;
+			Point3 t_max;
+
+			computeRayInit(current_origin, end, direction, current, ending, step, t_delta, t_max,
+										 depth);
+
+			if (current == ending)
+			{
+				continue;
+			}
+
+			batch_index[batch.size()] = i;
+			batch.add(current, ending, step, t_delta, t_max, max_range);
+			if (batch.full())
+			{
+				traverse();
+			}
 		}
+
+		traverse();
 	}
 
 	// bool getRayIntersection(const Point3& origin, const Point3& direction,
@@ -301,9 +755,15 @@ public:
 	//
 	// Pruning
 	//
+	/**
+	 * @brief Free the children of all nodes that do not need them. Used to get back the
+	 * memory when automatic pruning is disabled or concurrency is enabled.
+	 *
+	 */
 	void prune()
 	{
-		// TODO: Implement
+		releaseRetiredBlocks();
+		prune(root_, depth_levels_);
 	}
 
 	//
@@ -352,6 +812,11 @@ public:
 		Node<LEAF_NODE> node = getNode(code);
 		if (logit_value != node.node->logit)
 		{
+			if (concurrency_enabled_)
+			{
+				updateNodeValueConcurrent(code, logit_value, true);
+				return getNode(code);
+			}
 			return updateNodeValueRecurs(code, logit_value, root_, depth_levels_, true).first;
 		}
 		return node;
@@ -391,6 +856,11 @@ public:
 		{
 			return node;
 		}
+		if (concurrency_enabled_)
+		{
+			updateNodeValueConcurrent(code, logit_update, false);
+			return getNode(code);
+		}
 		return updateNodeValueRecurs(code, logit_update, root_, depth_levels_).first;
 	}
 
@@ -411,8 +881,52 @@ public:
 		return updateNodeValue(coordToKey(x, y, z, depth), logit_update);
 	}
 
-	//
-	// Integrate hit/miss
+	/**
+	 * @brief Update the value of many nodes at once
+	 *
+	 * @details The updates are sorted in Morton order and applied in a single top-down
+	 * pass. Each subtree is only descended once and each inner node is only updated once,
+	 * after all of its children have been updated. The result is the same as calling
+	 * updateNodeValue for each update, with coarser nodes updated before the nodes inside
+	 * of them. A coarse update that leaves its node free prunes the children, so the finer
+	 * updates inside of it are applied to the pruned node. This way a hit is never undone
+	 * by a coarse miss in the same batch, while applying the miss last could prune away
+	 * the hit.
+	 *
+	 * @param first Iterator to the first (code, logit update) pair
+	 * @param last Iterator to the element following the last (code, logit update) pair
+	 */
+	template <typename InputIt>
+	void updateNodeValues(InputIt first, InputIt last)
+	{
+		std::vector<std::pair<Code, float>> concurrent_batch;
+		std::vector<std::pair<Code, float>>& batch =
+				concurrency_enabled_ ? concurrent_batch : update_batch_;
+
+		for (; first != last; ++first)
+		{
+			// Codes created from keys at depth > 0 can have bits set below their depth
+			batch.emplace_back(first->first.toDepth(first->first.getDepth()), first->second);
+		}
+
+		if (concurrency_enabled_)
+		{
+			updateNodeValuesConcurrent(batch);
+			return;
+		}
+
+		sortUpdateBatch(batch);
+
+		size_t num_skipped = 0;
+		updateNodeValuesRecurs(batch.cbegin(), batch.cend(), root_, Code(0, depth_levels_),
+													 num_skipped);
+		num_skipped_updates_ += num_skipped;
+
+		batch.clear();
+	}
+
+	//
+	// Integrate hit/miss
 	//
 
 	Node<LEAF_NODE> integrateHit(const Node<LEAF_NODE>& node)
@@ -479,6 +993,68 @@ public:
 		return ((key_value >> depth) << depth) + (1 << (depth - 1)) + max_value_;
 	}
 
+	/**
+	 * @brief Converts many coordinates along one axis to keys at depth 0, eight at a time
+	 * with AVX2
+	 *
+	 * @param coords The coordinates
+	 * @param keys Where the keys are written
+	 * @param num The number of coordinates
+	 */
+	void coordsToKeys(const float* coords, KeyType* keys, size_t num) const
+	{
+		size_t i = 0;
+#if defined(__AVX2__)
+		const __m256 factor = _mm256_set1_ps(resolution_factor_);
+		const __m256i offset = _mm256_set1_epi32(max_value_);
+		for (; i + 8 <= num; i += 8)
+		{
+			__m256 value = _mm256_floor_ps(_mm256_mul_ps(factor, _mm256_loadu_ps(coords + i)));
+			_mm256_storeu_si256(
+					reinterpret_cast<__m256i*>(keys + i),
+					_mm256_add_epi32(_mm256_cvttps_epi32(value), offset));
+		}
+#endif
+		for (; i < num; ++i)
+		{
+			keys[i] = coordToKey(coords[i], 0);
+		}
+	}
+
+	/**
+	 * @brief Compute the code at depth 0 of each point in a point cloud
+	 *
+	 * @param cloud The point cloud
+	 * @param codes Where the codes are written, resized to the size of the point cloud
+	 */
+	template <typename CLOUD>
+	void coordsToCodes(const CLOUD& cloud, std::vector<uint64_t>& codes) const
+	{
+		constexpr size_t CHUNK_SIZE = 256;
+
+		codes.resize(cloud.size());
+
+		std::array<float, CHUNK_SIZE> coords[3];
+		std::array<KeyType, CHUNK_SIZE> keys[3];
+		for (size_t first = 0; first < cloud.size(); first += CHUNK_SIZE)
+		{
+			size_t num = std::min(CHUNK_SIZE, cloud.size() - first);
+			for (size_t i = 0; i < num; ++i)
+			{
+				const Point3 point = cloud[first + i];
+				coords[0][i] = point[0];
+				coords[1][i] = point[1];
+				coords[2][i] = point[2];
+			}
+			for (size_t axis = 0; axis < 3; ++axis)
+			{
+				coordsToKeys(coords[axis].data(), keys[axis].data(), num);
+			}
+			Code::toCodes(keys[0].data(), keys[1].data(), keys[2].data(), codes.data() + first,
+										num);
+		}
+	}
+
 	inline Key coordToKey(const Point3& coord, unsigned int depth = 0) const
 	{
 		return Key(coordToKey(coord[0], depth), coordToKey(coord[1], depth),
@@ -963,6 +1539,15 @@ public:
 		return 1.0 - (1.0 / (1.0 + std::exp(logit)));
 	}
 
+	/**
+	 * @brief The closest logit to logit that a node can store. Only differs from logit for
+	 * nodes with quantized logits.
+	 */
+	static float toNodeLogit(float logit)
+	{
+		return decltype(LEAF_NODE::logit)(logit);
+	}
+
 	float getOccupancyThres() const
 	{
 		return probability(occupancy_thres_log_);
@@ -1056,7 +1641,7 @@ public:
 
 	void setProbHitLog(float logit)
 	{
-		prob_hit_log_ = logit;
+		prob_hit_log_ = toNodeLogit(logit);
 	}
 
 	void setProbMiss(float probability)
@@ -1066,7 +1651,7 @@ public:
 
 	void setProbMissLog(float logit)
 	{
-		prob_miss_log_ = logit;
+		prob_miss_log_ = toNodeLogit(logit);
 	}
 
 	void setClampingThresMin(float probability)
@@ -1076,7 +1661,7 @@ public:
 
 	void setClampingThresMinLog(float logit)
 	{
-		clamping_thres_min_log_ = logit;
+		clamping_thres_min_log_ = toNodeLogit(logit);
 	}
 
 	void setClampingThresMax(float probability)
@@ -1086,7 +1671,7 @@ public:
 
 	void setClampingThresMaxLog(float logit)
 	{
-		clamping_thres_max_log_ = logit;
+		clamping_thres_max_log_ = toNodeLogit(logit);
 	}
 
 	//
@@ -1102,15 +1687,32 @@ public:
 	}
 
 	/**
-	 * @return size_t memory usage of the octree
+	 * @return size_t memory usage of the octree, including memory that the node allocator
+	 * keeps for reuse. The allocator is shared with the copies of the octree.
 	 */
 	size_t memoryUsage() const
+	{
+		return sizeof(root_) + node_allocator_->memoryUsage();
+	}
+
+	/**
+	 * @return size_t memory usage of the nodes currently in the octree
+	 */
+	size_t memoryUsageNodes() const
 	{
 		return (num_inner_nodes_ * memoryUsageInnerNode()) +
 					 (num_inner_leaf_nodes_ * memoryUsageInnerLeafNode()) +
 					 (num_leaf_nodes_ * memoryUsageLeafNode());
 	}
 
+	/**
+	 * @return size_t memory that the node allocator keeps for reuse
+	 */
+	size_t memoryUsageFree() const
+	{
+		return node_allocator_->memoryFree();
+	}
+
 	/**
 	 * @return size_t memory usage of a single inner node
 	 */
@@ -1299,13 +1901,37 @@ public:
 
 	void clear(float resolution, unsigned int depth_levels)
 	{
+		if (insert_session_active_)
+		{
+			throw std::invalid_argument("Cannot clear during an insert session");
+		}
 		if (21 < depth_levels)
 		{
 			throw std::invalid_argument("depth_levels can be maximum 21");
 		}
 
-		clear(root_, depth_levels_);
+		releaseRetiredBlocks();
+		if (1 == node_allocator_.use_count() &&
+				std::is_trivially_destructible_v<InnerNode<LEAF_NODE>>)
+		{
+			// All nodes are released at once, there is no need to visit them
+			node_allocator_->release(depth_levels);
+		}
+		else if (nullptr != root_.getChildren())
+		{
+			// Only the nodes that are not shared with a copy are released
+			releaseBlock(root_.getChildren(), depth_levels_);
+		}
 		root_ = InnerNode<LEAF_NODE>();
+		num_inner_nodes_ = 0;
+		num_inner_leaf_nodes_ = 1;
+		num_leaf_nodes_ = 0;
+		if (node_allocator_->isCompacting())
+		{
+			// Nothing left to move
+			node_allocator_->endCompaction();
+		}
+		compact_cursor_ = 0;
 
 		depth_levels_ = depth_levels;
 		max_value_ = std::pow(2, depth_levels - 1);
@@ -1327,6 +1953,69 @@ public:
 		}
 	}
 
+	//
+	// Compaction
+	//
+
+	/**
+	 * @brief Move all nodes to new memory in depth-first Morton order, so nodes that are
+	 * close in the octree are close in memory again after a long time of splitting and
+	 * pruning. Each depth has its own memory, so the nodes at a depth are also in
+	 * breadth-first order. The old memory is given back when the compaction is done.
+	 *
+	 * @details With a max_duration, the compaction stops when the time is up and continues
+	 * where it left off at the next call. The octree can be used and changed in between.
+	 *
+	 * @param max_duration Roughly the maximum time to spend, no limit by default
+	 * @return true If the compaction is done, false if there is more to do
+	 */
+	bool compact(std::chrono::steady_clock::duration max_duration =
+									 std::chrono::steady_clock::duration::max())
+	{
+		if (concurrency_enabled_)
+		{
+			throw std::invalid_argument("compact cannot be used while concurrency is enabled");
+		}
+		if (1 < node_allocator_.use_count())
+		{
+			if (node_allocator_->isCompacting())
+			{
+				// The copies keep nodes in the old memory, so it cannot be given back
+				node_allocator_->endCompaction();
+				compact_cursor_ = 0;
+			}
+			throw std::invalid_argument("compact cannot be used on an octree with copies");
+		}
+		// They can be in the memory that is given back
+		releaseRetiredBlocks();
+
+		auto deadline = std::chrono::steady_clock::time_point::max();
+		if (std::chrono::steady_clock::duration::max() != max_duration)
+		{
+			deadline = std::chrono::steady_clock::now() + max_duration;
+		}
+
+		if (!node_allocator_->isCompacting())
+		{
+			node_allocator_->beginCompaction();
+			compact_cursor_ = 0;
+		}
+
+		if (!compactRecurs(root_, depth_levels_, 0, compact_cursor_, deadline))
+		{
+			return false;
+		}
+
+		node_allocator_->endCompaction();
+		compact_cursor_ = 0;
+		return true;
+	}
+
+	bool isCompacting() const
+	{
+		return node_allocator_->isCompacting();
+	}
+
 	//
 	// Node functions
 	//
@@ -1362,9 +2051,9 @@ public:
 			unsigned int child_idx = code.getChildIdx(depth - 1);
 
 			current_node = (1 == depth) ? &(*static_cast<std::array<LEAF_NODE, 8>*>(
-																				inner_node->children))[child_idx] :
+																				inner_node->getChildren()))[child_idx] :
 																		&(*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(
-																				inner_node->children))[child_idx];
+																				inner_node->getChildren()))[child_idx];
 		}
 
 		return Node<LEAF_NODE>(current_node, code);
@@ -1441,6 +2130,114 @@ public:
 		return automatic_pruning_enabled_;
 	}
 
+	/**
+	 * @brief Skip updates of subtrees where all leaves are already clamped in the direction
+	 * of the updates. The tree is the same as without skipping, the leaves and their
+	 * parents are just not visited.
+	 *
+	 * @details Helps most in static scenes where pruning cannot collapse the clamped
+	 * regions, e.g. with automatic pruning disabled or when the colors differ.
+	 *
+	 * @param enable Whether to skip saturated subtrees, enabled by default
+	 */
+	void setSaturationSkipping(bool enable)
+	{
+		saturation_skipping_enabled_ = enable;
+	}
+
+	bool isSaturationSkippingEnabled() const
+	{
+		return saturation_skipping_enabled_;
+	}
+
+	/**
+	 * @return The number of updates that were skipped because the voxels were already
+	 * clamped, since the last call to resetNumSkippedUpdates
+	 */
+	size_t getNumSkippedUpdates() const
+	{
+		return num_skipped_updates_;
+	}
+
+	void resetNumSkippedUpdates()
+	{
+		num_skipped_updates_ = 0;
+	}
+
+	/**
+	 * @brief Set the number of threads used for ray tracing when inserting point clouds
+	 *
+	 * @details Each thread traces its part of the point cloud into a private set of
+	 * updates. The sets are merged before the tree is updated, so the resulting map is the
+	 * same as with a single thread.
+	 *
+	 * @param num_threads The number of threads, 0 or 1 means serial insertion
+	 */
+	void setNumThreads(unsigned int num_threads)
+	{
+		num_threads_ = std::max(1u, num_threads);
+	}
+
+	unsigned int getNumThreads() const
+	{
+		return num_threads_;
+	}
+
+	/**
+	 * @brief Enable or disable concurrent access to the octree.
+	 *
+	 * @details When enabled, any number of threads can write to the octree with
+	 * insertPointCloud, insertPointCloudDiscrete, updateNodeValues, updateNodeValue,
+	 * setNodeValue, integrateHit, integrateMiss and clearAreaBBX. Other threads read from
+	 * a copy of the octree (see snapshot), not from the octree itself.
+	 *
+	 * The consistency model is:
+	 * - The octree is divided into 8^CONCURRENT_LEVELS subtrees, rooted
+	 * CONCURRENT_LEVELS levels below the root, each guarded by its own mutex. Writers lock
+	 * one subtree at a time. Updates to different subtrees run in parallel, updates to the
+	 * same subtree are applied one call at a time. A call that touches several subtrees is
+	 * not atomic, another writer can update some of its subtrees in between.
+	 * - After a subtree has been updated, the nodes above it are updated under a separate
+	 * mutex. The levels above the subtrees are never pruned while concurrent. Updates
+	 * coarser than the subtrees are applied to each subtree they cover.
+	 * - Reading the octree (getNode, isOccupied/isFree/isUnknown, castRay, the iterators,
+	 * write) while a writer is active is a data race, since the values of the nodes are not
+	 * atomic. Readers take a copy instead, which waits for the writers that are active,
+	 * takes constant time and then shares the nodes with the octree until a writer changes
+	 * them. Nodes are not pruned while concurrent, pruning is deferred.
+	 * - Everything else that changes the octree (clear, read, prune, the setters,
+	 * resetChangeDetection, the color of OctreeRGB) requires that no other thread uses the
+	 * octree. Calling prune() at such a time gives back the memory of the deferred pruning
+	 * and of the children that were replaced by copy-on-write.
+	 * - Each insertPointCloud call does its ray tracing in the calling thread,
+	 * setNumThreads has no effect.
+	 *
+	 * @remark Has to be called while no other thread uses the octree
+	 *
+	 * @param enable Whether concurrent access should be enabled
+	 */
+	void enableConcurrency(bool enable = true)
+	{
+		if (enable && insert_session_active_)
+		{
+			throw std::invalid_argument(
+					"Concurrency cannot be enabled during an insert session");
+		}
+		if (enable && !subtree_mutexes_)
+		{
+			subtree_mutexes_ =
+					std::make_unique<std::mutex[]>(size_t(1) << (3 * CONCURRENT_LEVELS));
+		}
+		concurrency_enabled_ = enable;
+		// Copies share the allocator and can be used from other threads
+		node_allocator_->setThreadSafe(enable || 1 < node_allocator_.use_count());
+	}
+
+	bool isConcurrencyEnabled() const
+	{
+		return concurrency_enabled_;
+	}
+
 	//
 	// Read/write
 	//
@@ -1706,11 +2503,12 @@ protected:
 		, max_value_(std::pow(2, depth_levels - 1))
 		, occupancy_thres_log_(logit(occupancy_thres))
 		, free_thres_log_(logit(free_thres))
-		, prob_hit_log_(logit(prob_hit))
-		, prob_miss_log_(logit(prob_miss))
-		, clamping_thres_min_log_(logit(clamping_thres_min))
-		, clamping_thres_max_log_(logit(clamping_thres_max))
+		, prob_hit_log_(toNodeLogit(logit(prob_hit)))
+		, prob_miss_log_(toNodeLogit(logit(prob_miss)))
+		, clamping_thres_min_log_(toNodeLogit(logit(clamping_thres_min)))
+		, clamping_thres_max_log_(toNodeLogit(logit(clamping_thres_max)))
 		, automatic_pruning_enabled_(automatic_pruning)
+		, node_allocator_(std::make_shared<NodeAllocator<LEAF_NODE>>(depth_levels))
 	{
 		if (21 < depth_levels)
 		{
@@ -1733,6 +2531,83 @@ protected:
 		// discretize_.reserve(10007);
 	}
 
+	/**
+	 * @brief Copy other in constant time. The copy shares all nodes with other, a node is
+	 * only copied when one of the octrees changes it (copy-on-write). A copy can be read,
+	 * and written, from a different thread than other.
+	 *
+	 * @remark If other has concurrency enabled, the writers of other are blocked while
+	 * copying and the levels above the subtrees are copied directly
+	 */
+	OctreeBase(const OctreeBase& other)
+		: resolution_(other.resolution_)
+		, resolution_factor_(other.resolution_factor_)
+		, depth_levels_(other.depth_levels_)
+		, max_value_(other.max_value_)
+		, occupancy_thres_log_(other.occupancy_thres_log_)
+		, free_thres_log_(other.free_thres_log_)
+		, prob_hit_log_(other.prob_hit_log_)
+		, prob_miss_log_(other.prob_miss_log_)
+		, clamping_thres_min_log_(other.clamping_thres_min_log_)
+		, clamping_thres_max_log_(other.clamping_thres_max_log_)
+		, bbx_limit_enabled_(other.bbx_limit_enabled_)
+		, bbx_min_(other.bbx_min_)
+		, bbx_max_(other.bbx_max_)
+		, bbx_min_key_(other.bbx_min_key_)
+		, bbx_max_key_(other.bbx_max_key_)
+		, change_detection_enabled_(other.change_detection_enabled_)
+		, nodes_sizes_(other.nodes_sizes_)
+		, nodes_half_sizes_(other.nodes_half_sizes_)
+		, automatic_pruning_enabled_(other.automatic_pruning_enabled_)
+		, saturation_skipping_enabled_(other.saturation_skipping_enabled_)
+		, node_allocator_(other.node_allocator_)
+		, num_threads_(other.num_threads_)
+	{
+		// Wait for the writers of other to finish
+		std::unique_lock<std::mutex> top_lock(other.top_mutex_, std::defer_lock);
+		size_t num_subtrees = 0;
+		if (other.concurrency_enabled_)
+		{
+			top_lock.lock();
+			num_subtrees = size_t(1) << (3 * (other.depth_levels_ - other.getLockDepth()));
+			for (size_t i = 0; i < num_subtrees; ++i)
+			{
+				other.subtree_mutexes_[i].lock();
+			}
+		}
+		else
+		{
+			node_allocator_->setThreadSafe(true);
+		}
+
+		root_ = other.root_;
+		if (nullptr != root_.getChildren())
+		{
+			++getRefCount(root_, depth_levels_);
+		}
+		num_inner_nodes_ = other.num_inner_nodes_.load();
+		num_inner_leaf_nodes_ = other.num_inner_leaf_nodes_.load();
+		num_leaf_nodes_ = other.num_leaf_nodes_.load();
+		{
+			std::lock_guard<std::mutex> change_lock(other.change_mutex_);
+			changed_codes_ = other.changed_codes_;
+		}
+
+		if (other.concurrency_enabled_)
+		{
+			// The writers of other keep pointers to the nodes above the subtrees, so they have
+			// to stay with other
+			makeTopLevelsUnique(root_, depth_levels_, other.getLockDepth());
+
+			for (size_t i = 0; i < num_subtrees; ++i)
+			{
+				other.subtree_mutexes_[i].unlock();
+			}
+		}
+
+		indices_.max_load_factor(0.8);
+	}
+
 	//
 	// Update node value
 	//
@@ -1751,6 +2626,10 @@ protected:
 			{
 				createChildren(inner_node, current_depth);
 			}
+			else
+			{
+				makeChildrenUnique(inner_node, current_depth);
+			}
 
 			unsigned int child_depth = current_depth - 1;
 
@@ -1760,9 +2639,10 @@ protected:
 			// Get child
 			LEAF_NODE* child_node =
 					(0 == child_depth) ?
-							&(*static_cast<std::array<LEAF_NODE, 8>*>(inner_node.children))[child_idx] :
+							&(*static_cast<std::array<LEAF_NODE, 8>*>(
+									inner_node.getChildren()))[child_idx] :
 							&(*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(
-									inner_node.children))[child_idx];
+									inner_node.getChildren()))[child_idx];
 
 			auto [child, changed] =
 					updateNodeValueRecurs(code, logit_value, *child_node, child_depth, set_value);
@@ -1774,7 +2654,7 @@ protected:
 				changed = updateNode(inner_node, current_depth);
 				if (changed && change_detection_enabled_)
 				{
-					changed_codes_.insert(code.toDepth(current_depth));
+					addChangedCode(code.toDepth(current_depth));
 				}
 			}
 			return std::make_pair(child, changed);
@@ -1812,15 +2692,16 @@ protected:
 					}
 					else if (hasChildren(inner_node))
 					{
+						makeChildrenUnique(inner_node, current_depth);
 						unsigned int child_depth = current_depth - 1;
 						for (unsigned int child_idx = 0; child_idx < 8; ++child_idx)
 						{
 							LEAF_NODE* child_node =
 									(0 == child_depth) ?
 											&(*static_cast<std::array<LEAF_NODE, 8>*>(
-													inner_node.children))[child_idx] :
+													inner_node.getChildren()))[child_idx] :
 											&(*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(
-													inner_node.children))[child_idx];
+													inner_node.getChildren()))[child_idx];
 							updateNodeValueRecurs(code.getChild(child_idx), logit_value, *child_node,
 																		child_depth, set_value);
 						}
@@ -1832,105 +2713,563 @@ protected:
 
 			if (change_detection_enabled_)
 			{
-				changed_codes_.insert(code);
+				addChangedCode(code);
 			}
 
 			return std::make_pair(Node<LEAF_NODE>(&node, code), true);
 		}
 	}
 
-	//
-	// Update node
-	//
+	using UpdateBatchIterator = typename std::vector<std::pair<Code, float>>::const_iterator;
 
-	virtual bool updateNode(InnerNode<LEAF_NODE>& node, unsigned int depth)
+	bool updateNodeValuesRecurs(UpdateBatchIterator first, UpdateBatchIterator last,
+															LEAF_NODE& node, const Code& code, size_t& num_skipped)
 	{
-		if (!hasChildren(node))  // Should this be here?
+		unsigned int current_depth = code.getDepth();
+		bool changed = false;
+
+		// Updates for this node, since they are sorted these come before the children
+		UpdateBatchIterator node_first = first;
+		for (; first != last && current_depth == first->first.getDepth(); ++first)
 		{
-			node.contains_free = isFree(node);
-			node.contains_unknown = isUnknown(node);
-			return false;
+			if (!isSaturated(node, first->second))
+			{
+				updateNodeValueRecurs(code, first->second, node, current_depth);
+				changed = true;
+			}
+			else
+			{
+				++num_skipped;
+			}
 		}
-		else if (1 == depth)
+
+		if (0 == current_depth && update_leaf_data_ && node_first != first &&
+				updateLeafData(node, code, std::prev(first)->second))
 		{
-			return updateNode(node, (*static_cast<std::array<LEAF_NODE, 8>*>(node.children)),
-												depth);
+			if (change_detection_enabled_)
+			{
+				addChangedCode(code);
+			}
+			changed = true;
 		}
-		else
+
+		if (first == last)
 		{
-			return updateNode(
-					node, (*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(node.children)),
-					depth);
+			return changed;
 		}
-	}
 
-	virtual bool updateNode(InnerNode<LEAF_NODE>& node,
-													const std::array<LEAF_NODE, 8>& children, unsigned int depth)
-	{
-		float new_logit;
-		bool new_contains_free;
-		bool new_contains_unknown;
+		InnerNode<LEAF_NODE>& inner_node = static_cast<InnerNode<LEAF_NODE>&>(node);
 
-		if (isNodeCollapsible(children))
+		if (!hasChildren(inner_node))
 		{
-			new_logit = children[0].logit;
-			new_contains_free = isFreeLog(new_logit);
-			new_contains_unknown = isUnknownLog(new_logit);
-			deleteChildren(node, depth);
+			if (std::all_of(first, last, [this, &node](const std::pair<Code, float>& update) {
+						return isSaturated(node, update.second);
+					}))
+			{
+				// None of the children would change
+				num_skipped += std::distance(first, last);
+				return changed;
+			}
+			createChildren(inner_node, current_depth);
 		}
 		else
 		{
-			new_logit = getMaxChildLogit(children);
-			new_contains_free = false;
-			new_contains_unknown = false;
-			for (const LEAF_NODE& child : children)
+			if (saturation_skipping_enabled_ && isSubtreeSaturated(inner_node, first->second) &&
+					std::all_of(std::next(first), last,
+											[this, &inner_node](const std::pair<Code, float>& update) {
+												return isSubtreeSaturated(inner_node, update.second);
+											}))
 			{
-				if (isFree(child))
-				{
-					new_contains_free = true;
-				}
-				else if (isUnknown(child))
-				{
-					new_contains_unknown = true;
-				}
+				// All leaves below are clamped in the direction of the updates, so neither the
+				// leaves nor this node would change
+				num_skipped += std::distance(first, last);
+				return changed;
 			}
+			makeChildrenUnique(inner_node, current_depth);
 		}
 
-		if (node.logit != new_logit || node.contains_free != new_contains_free ||
-				node.contains_unknown != new_contains_unknown)
+		unsigned int child_depth = current_depth - 1;
+		bool child_changed = false;
+		while (first != last)
 		{
-			node.logit = new_logit;
-			node.contains_free = new_contains_free;
-			node.contains_unknown = new_contains_unknown;
-			return true;
-		}
+			// Get child index
+			unsigned int child_idx = first->first.getChildIdx(child_depth);
 
-		return false;
-	}
+			// All updates for the child are next to each other
+			UpdateBatchIterator child_last =
+					std::find_if(first, last, [child_idx, child_depth](const auto& update) {
+						return update.first.getChildIdx(child_depth) != child_idx;
+					});
 
-	virtual bool updateNode(InnerNode<LEAF_NODE>& node,
-													const std::array<InnerNode<LEAF_NODE>, 8>& children,
-													unsigned int depth)
-	{
-		float new_logit;
-		bool new_contains_free;
-		bool new_contains_unknown;
+			// Get child
+			LEAF_NODE* child_node =
+					(0 == child_depth) ?
+							&(*static_cast<std::array<LEAF_NODE, 8>*>(
+									inner_node.getChildren()))[child_idx] :
+							&(*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(
+									inner_node.getChildren()))[child_idx];
 
-		if (isNodeCollapsible(children))
-		{
-			new_logit = children[0].logit;
-			new_contains_free = isFreeLog(new_logit);
-			new_contains_unknown = isUnknownLog(new_logit);
-			deleteChildren(node, depth);
+			// Recurs
+			if (updateNodeValuesRecurs(first, child_last, *child_node, code.getChild(child_idx),
+																 num_skipped))
+			{
+				child_changed = true;
+			}
+
+			first = child_last;
 		}
-		else
+
+		// Update this node once all children have been updated
+		if (child_changed && updateNode(inner_node, current_depth))
 		{
-			new_logit = getMaxChildLogit(children);
-			new_contains_free = false;
-			new_contains_unknown = false;
-			for (const InnerNode<LEAF_NODE>& child : children)
+			if (change_detection_enabled_)
 			{
-				if (containsFree(child))
+				addChangedCode(code);
+			}
+			changed = true;
+		}
+
+		return changed;
+	}
+
+	bool isSaturated(const LEAF_NODE& node, float logit_update) const
+	{
+		return (0 <= logit_update && node.logit >= clamping_thres_max_log_) ||
+					 (0 >= logit_update && node.logit <= clamping_thres_min_log_);
+	}
+
+	/**
+	 * @brief Check if a logit update would change none of the leaves under a node. The
+	 * logit of a node is the max of its children, so for misses it is enough that the node
+	 * is at the min clamping threshold. For hits all leaves have to be at the max clamping
+	 * threshold, which they are if the node is there and uniform.
+	 *
+	 * @remark Hits are never skipped while update_leaf_data_ is set, since the leaf data
+	 * can change even though the logit does not
+	 */
+	bool isSubtreeSaturated(const InnerNode<LEAF_NODE>& node, float logit_update) const
+	{
+		return (0 <= logit_update && !update_leaf_data_ && isUniform(node) &&
+						node.logit >= clamping_thres_max_log_) ||
+					 (0 >= logit_update && node.logit <= clamping_thres_min_log_);
+	}
+
+	void sortUpdateBatch(std::vector<std::pair<Code, float>>& batch)
+	{
+		if (batch.size() < MIN_RADIX_SORT_SIZE)
+		{
+			std::sort(batch.begin(), batch.end(),
+								[](const std::pair<Code, float>& a, const std::pair<Code, float>& b) {
+									return a.first.getCode() < b.first.getCode() ||
+												 (a.first.getCode() == b.first.getCode() &&
+													a.first.getDepth() > b.first.getDepth());
+								});
+			return;
+		}
+
+		// Same order as above, first the tie breaker on depth then the code since the sort
+		// is stable
+		std::vector<std::pair<Code, float>> concurrent_buffer;
+		std::vector<std::pair<Code, float>>& buffer =
+				concurrency_enabled_ ? concurrent_buffer : sort_buffer_;
+		radixSort(batch, buffer, 8, [this](const std::pair<Code, float>& update) {
+			return static_cast<uint64_t>(depth_levels_ - update.first.getDepth());
+		});
+		radixSort(batch, buffer, 3 * depth_levels_,
+							[](const std::pair<Code, float>& update) { return update.first.getCode(); });
+	}
+
+	void addChangedCode(const Code& code)
+	{
+		if (concurrency_enabled_)
+		{
+			std::lock_guard<std::mutex> lock(change_mutex_);
+			changed_codes_.insert(code);
+		}
+		else
+		{
+			changed_codes_.insert(code);
+		}
+	}
+
+	//
+	// Concurrency
+	//
+
+	/**
+	 * @return unsigned int The depth of the roots of the subtrees that are locked
+	 * separately
+	 */
+	unsigned int getLockDepth() const
+	{
+		return depth_levels_ - std::min(CONCURRENT_LEVELS, depth_levels_ - 1);
+	}
+
+	/**
+	 * @return size_t The index of the subtree that code, at the lock depth or below, is in
+	 */
+	size_t getSubtreeIndex(const Code& code) const
+	{
+		return code.getCode() >> (3 * getLockDepth());
+	}
+
+	Code getSubtreeCode(size_t subtree) const
+	{
+		unsigned int lock_depth = getLockDepth();
+		return Code(static_cast<uint64_t>(subtree) << (3 * lock_depth), lock_depth);
+	}
+
+	/**
+	 * @brief Get a node at the lock depth or above, creating the levels above the lock
+	 * depth if they do not exist yet
+	 */
+	InnerNode<LEAF_NODE>& getTopNode(const Code& code)
+	{
+		InnerNode<LEAF_NODE>* node = &root_;
+		for (unsigned int depth = depth_levels_; depth > code.getDepth(); --depth)
+		{
+			if (!hasChildren(*node))
+			{
+				std::lock_guard<std::mutex> lock(top_mutex_);
+				if (!hasChildren(*node))
+				{
+					createChildren(*node, depth);
+				}
+			}
+			node = &(*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(
+					node->getChildren()))[code.getChildIdx(depth - 1)];
+		}
+		return *node;
+	}
+
+	/**
+	 * @brief Apply update(subtree_root, subtree_code) to a subtree while holding its lock
+	 *
+	 * @return bool Whether the root of the subtree changed
+	 */
+	template <typename UPDATE>
+	bool updateSubtreeConcurrent(size_t subtree, UPDATE update)
+	{
+		Code subtree_code = getSubtreeCode(subtree);
+		InnerNode<LEAF_NODE>& subtree_root = getTopNode(subtree_code);
+		std::lock_guard<std::mutex> lock(subtree_mutexes_[subtree]);
+		return update(subtree_root, subtree_code);
+	}
+
+	/**
+	 * @brief Update the nodes above the subtrees that have changed
+	 *
+	 * @param subtrees The changed subtrees, in ascending order
+	 */
+	void propagateConcurrent(std::vector<size_t> subtrees)
+	{
+		std::lock_guard<std::mutex> top_lock(top_mutex_);
+
+		std::vector<size_t> parents;
+		for (unsigned int depth = getLockDepth() + 1; depth <= depth_levels_; ++depth)
+		{
+			parents.clear();
+			for (size_t index : subtrees)
+			{
+				size_t parent = index >> 3;
+				if (!parents.empty() && parents.back() == parent)
+				{
+					continue;
+				}
+				parents.push_back(parent);
+
+				Code parent_code(static_cast<uint64_t>(parent) << (3 * depth), depth);
+				InnerNode<LEAF_NODE>& node = getTopNode(parent_code);
+
+				bool changed;
+				if (getLockDepth() + 1 == depth)
+				{
+					// The children are the roots of the subtrees
+					for (size_t i = 0; i < 8; ++i)
+					{
+						subtree_mutexes_[(parent << 3) + i].lock();
+					}
+					changed = updateNode(node, depth);
+					for (size_t i = 0; i < 8; ++i)
+					{
+						subtree_mutexes_[(parent << 3) + i].unlock();
+					}
+				}
+				else
+				{
+					changed = updateNode(node, depth);
+				}
+
+				if (!changed)
+				{
+					parents.pop_back();
+				}
+				else if (change_detection_enabled_)
+				{
+					addChangedCode(parent_code);
+				}
+			}
+
+			if (parents.empty())
+			{
+				return;
+			}
+			subtrees.swap(parents);
+		}
+	}
+
+	void updateNodeValueConcurrent(const Code& code, float logit_value, bool set_value)
+	{
+		std::vector<size_t> changed;
+		updateNodeValueConcurrent(code.toDepth(code.getDepth()), logit_value, set_value,
+															changed);
+		if (!changed.empty())
+		{
+			propagateConcurrent(std::move(changed));
+		}
+	}
+
+	void updateNodeValueConcurrent(const Code& code, float logit_value, bool set_value,
+																 std::vector<size_t>& changed)
+	{
+		unsigned int lock_depth = getLockDepth();
+		if (lock_depth >= code.getDepth())
+		{
+			size_t subtree = getSubtreeIndex(code);
+			if (updateSubtreeConcurrent(subtree, [&](InnerNode<LEAF_NODE>& node,
+																							 const Code& subtree_code) {
+						return updateNodeValueRecurs(code, logit_value, node, lock_depth, set_value)
+								.second;
+					}))
+			{
+				changed.push_back(subtree);
+			}
+			return;
+		}
+
+		// Above the subtrees, do what updateNodeValueRecurs would do but without pruning
+		if (!set_value)
+		{
+			float logit = std::clamp(getTopNode(code).logit + logit_value,
+															 clamping_thres_min_log_, clamping_thres_max_log_);
+			if (!isOccupiedLog(logit))
+			{
+				// Would have been pruned
+				logit_value = logit;
+				set_value = true;
+			}
+		}
+
+		for (unsigned int child_idx = 0; child_idx < 8; ++child_idx)
+		{
+			updateNodeValueConcurrent(code.getChild(child_idx), logit_value, set_value,
+																changed);
+		}
+	}
+
+	void updateNodeValuesConcurrent(std::vector<std::pair<Code, float>>& batch)
+	{
+		sortUpdateBatch(batch);
+
+		std::vector<size_t> changed;
+
+		// Updates coarser than the subtrees first, they come before the updates inside them
+		unsigned int lock_depth = getLockDepth();
+		auto first = batch.cbegin();
+		auto last = batch.cend();
+		for (auto it = first; it != last; ++it)
+		{
+			if (lock_depth < it->first.getDepth())
+			{
+				updateNodeValueConcurrent(it->first, it->second, false, changed);
+			}
+		}
+
+		while (first != last)
+		{
+			if (lock_depth < first->first.getDepth())
+			{
+				++first;
+				continue;
+			}
+
+			size_t subtree = getSubtreeIndex(first->first);
+
+			// All updates for the subtree are next to each other
+			auto subtree_last = std::find_if(first, last, [this, subtree](const auto& update) {
+				return getSubtreeIndex(update.first) != subtree;
+			});
+
+			auto update = [this, first, subtree_last](InnerNode<LEAF_NODE>& node,
+																							 const Code& subtree_code) {
+				size_t num_skipped = 0;
+				bool subtree_changed =
+						updateNodeValuesRecurs(first, subtree_last, node, subtree_code, num_skipped);
+				num_skipped_updates_ += num_skipped;
+				return subtree_changed;
+			};
+			if (updateSubtreeConcurrent(subtree, update))
+			{
+				changed.push_back(subtree);
+			}
+
+			first = subtree_last;
+		}
+
+		if (!changed.empty())
+		{
+			std::sort(changed.begin(), changed.end());
+			changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+			propagateConcurrent(std::move(changed));
+		}
+	}
+
+	//
+	// Update leaf data
+	//
+
+	/**
+	 * @brief Called by updateNodeValues, while update_leaf_data_ is set, for each leaf
+	 * that got an update. Lets derived octrees update their own data in the same pass as
+	 * the logits, before the parents are updated.
+	 *
+	 * @param leaf The leaf, with its new logit
+	 * @param code The code of the leaf
+	 * @param logit_update The last logit update of the leaf
+	 * @return true If the leaf changed
+	 */
+	virtual bool updateLeafData(LEAF_NODE& leaf, const Code& code, float logit_update)
+	{
+		return false;
+	}
+
+	/**
+	 * @brief Sets update_leaf_data_ while it exists, and resets it also when the update
+	 * throws
+	 */
+	class LeafDataUpdate
+	{
+	public:
+		explicit LeafDataUpdate(OctreeBase& octree) : octree_(octree)
+		{
+			octree_.update_leaf_data_ = true;
+		}
+
+		~LeafDataUpdate()
+		{
+			octree_.update_leaf_data_ = false;
+		}
+
+		LeafDataUpdate(const LeafDataUpdate&) = delete;
+		LeafDataUpdate& operator=(const LeafDataUpdate&) = delete;
+
+	private:
+		OctreeBase& octree_;
+	};
+
+	//
+	// Update node
+	//
+
+	virtual bool updateNode(InnerNode<LEAF_NODE>& node, unsigned int depth)
+	{
+		if (!hasChildren(node))  // Should this be here?
+		{
+			node.contains_free = isFree(node);
+			node.contains_unknown = isUnknown(node);
+			return false;
+		}
+		else if (1 == depth)
+		{
+			return updateNode(
+					node, (*static_cast<std::array<LEAF_NODE, 8>*>(node.getChildren())), depth);
+		}
+		else
+		{
+			return updateNode(
+					node, (*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(node.getChildren())),
+					depth);
+		}
+	}
+
+	virtual bool updateNode(InnerNode<LEAF_NODE>& node,
+													const std::array<LEAF_NODE, 8>& children, unsigned int depth)
+	{
+		float new_logit;
+		bool new_contains_free;
+		bool new_contains_unknown;
+		bool new_uniform;
+
+		if (isNodeCollapsible(children))
+		{
+			new_logit = children[0].logit;
+			new_contains_free = isFreeLog(new_logit);
+			new_contains_unknown = isUnknownLog(new_logit);
+			new_uniform = true;
+			deleteChildren(node, depth);
+		}
+		else
+		{
+			new_logit = getMaxChildLogit(children);
+			new_contains_free = false;
+			new_contains_unknown = false;
+			new_uniform = true;
+			for (const LEAF_NODE& child : children)
+			{
+				if (isFree(child))
+				{
+					new_contains_free = true;
+				}
+				else if (isUnknown(child))
+				{
+					new_contains_unknown = true;
+				}
+				if (new_logit != child.logit)
+				{
+					new_uniform = false;
+				}
+			}
+		}
+
+		if (node.logit != new_logit || node.contains_free != new_contains_free ||
+				node.contains_unknown != new_contains_unknown || node.uniform != new_uniform)
+		{
+			node.logit = new_logit;
+			node.contains_free = new_contains_free;
+			node.contains_unknown = new_contains_unknown;
+			node.uniform = new_uniform;
+			return true;
+		}
+
+		return false;
+	}
+
+	virtual bool updateNode(InnerNode<LEAF_NODE>& node,
+													const std::array<InnerNode<LEAF_NODE>, 8>& children,
+													unsigned int depth)
+	{
+		float new_logit;
+		bool new_contains_free;
+		bool new_contains_unknown;
+		bool new_uniform;
+
+		if (isNodeCollapsible(children))
+		{
+			new_logit = children[0].logit;
+			new_contains_free = isFreeLog(new_logit);
+			new_contains_unknown = isUnknownLog(new_logit);
+			new_uniform = true;
+			deleteChildren(node, depth);
+		}
+		else
+		{
+			new_logit = getMaxChildLogit(children);
+			new_contains_free = false;
+			new_contains_unknown = false;
+			new_uniform = true;
+			for (const InnerNode<LEAF_NODE>& child : children)
+			{
+				if (containsFree(child))
 				{
 					new_contains_free = true;
 				}
@@ -1938,15 +3277,20 @@ protected:
 				{
 					new_contains_unknown = true;
 				}
+				if (new_logit != child.logit || !isUniform(child))
+				{
+					new_uniform = false;
+				}
 			}
 		}
 
 		if (node.logit != new_logit || node.contains_free != new_contains_free ||
-				node.contains_unknown != new_contains_unknown)
+				node.contains_unknown != new_contains_unknown || node.uniform != new_uniform)
 		{
 			node.logit = new_logit;
 			node.contains_free = new_contains_free;
 			node.contains_unknown = new_contains_unknown;
+			node.uniform = new_uniform;
 			return true;
 		}
 
@@ -2027,188 +3371,847 @@ protected:
 	// Create / delete children
 	//
 
-	void createChildren(InnerNode<LEAF_NODE>& inner_node, unsigned int depth)
-	{
-		// TODO: Add mutex?
-		if (1 == depth)
-		{
-			if (nullptr == inner_node.children)
+	void createChildren(InnerNode<LEAF_NODE>& inner_node, unsigned int depth)
+	{
+		if (nullptr != inner_node.getChildren() && 1 < getRefCount(inner_node, depth))
+		{
+			// Shared with a copy, all children are set below so there is no need to copy them
+			removeNodeCounts(inner_node, depth);
+			retireBlock(inner_node.getChildren(), depth);
+			inner_node.setChildren(nullptr);
+		}
+
+		if (1 == depth)
+		{
+			if (nullptr == inner_node.getChildren())
+			{
+				inner_node.setChildren(node_allocator_->allocateLeafBlock());
+				num_leaf_nodes_ += 8;
+				num_inner_leaf_nodes_ -= 1;
+				num_inner_nodes_ += 1;
+			}
+			for (LEAF_NODE& child :
+					 *static_cast<std::array<LEAF_NODE, 8>*>(inner_node.getChildren()))
+			{
+				child.logit = inner_node.logit;
+			}
+		}
+		else
+		{
+			if (nullptr == inner_node.getChildren())
+			{
+				inner_node.setChildren(node_allocator_->allocateInnerBlock(depth));
+				num_inner_leaf_nodes_ += 7;  // Get 8 new and 1 is made into a inner node
+				num_inner_nodes_ += 1;
+			}
+			for (InnerNode<LEAF_NODE>& child :
+					 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.getChildren()))
+			{
+				child.logit = inner_node.logit;
+				child.contains_free = inner_node.contains_free;
+				child.contains_unknown = inner_node.contains_unknown;
+				child.setAllChildrenSame(true);
+				// child.setChildren(nullptr);
+			}
+		}
+		inner_node.uniform = true;  // All children got the logit of the node
+		// Publishes the initialized children to concurrent readers
+		inner_node.setAllChildrenSame(false);
+	}
+
+	void deleteChildren(InnerNode<LEAF_NODE>& inner_node, unsigned int depth,
+											bool manual_pruning = false)
+	{
+		if (concurrency_enabled_ && !manual_pruning && getLockDepth() < depth)
+		{
+			// The levels above the subtrees are kept while concurrent
+			return;
+		}
+
+		inner_node.setAllChildrenSame(true);
+
+		if (nullptr == inner_node.getChildren() ||
+				(!manual_pruning && (!automatic_pruning_enabled_ || concurrency_enabled_)))
+		{
+			return;
+		}
+
+		removeNodeCounts(inner_node, depth);
+		releaseBlock(inner_node.getChildren(), depth);
+		inner_node.setChildren(nullptr);
+	}
+
+	/**
+	 * @brief Update the node counts as if all descendants of inner_node were deleted
+	 */
+	void removeNodeCounts(const InnerNode<LEAF_NODE>& inner_node, unsigned int depth)
+	{
+		if (1 == depth)
+		{
+			num_leaf_nodes_ -= 8;
+			num_inner_leaf_nodes_ += 1;
+			num_inner_nodes_ -= 1;
+		}
+		else
+		{
+			unsigned int child_depth = depth - 1;
+			for (const InnerNode<LEAF_NODE>& child :
+					 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.getChildren()))
+			{
+				if (nullptr != child.getChildren())
+				{
+					removeNodeCounts(child, child_depth);
+				}
+			}
+			num_inner_leaf_nodes_ -=
+					7;  // Remove 8 and 1 inner node is made into a inner leaf node
+			num_inner_nodes_ -= 1;
+		}
+	}
+
+	//
+	// Copy-on-write
+	//
+
+	using LeafBlock = typename NodeAllocator<LEAF_NODE>::LeafBlock;
+	using InnerBlock = typename NodeAllocator<LEAF_NODE>::InnerBlock;
+
+	/**
+	 * @return The number of inner nodes, in this octree and its copies, that point to the
+	 * children of inner_node
+	 */
+	std::atomic<uint32_t>& getRefCount(const InnerNode<LEAF_NODE>& inner_node,
+																		 unsigned int depth) const
+	{
+		return 1 == depth ? static_cast<LeafBlock*>(inner_node.getChildren())->ref_count :
+												static_cast<InnerBlock*>(inner_node.getChildren())->ref_count;
+	}
+
+	/**
+	 * @brief Drop a reference to children, they are freed when no inner node points to
+	 * them anymore
+	 *
+	 * @param children The children
+	 * @param depth The depth of the parent of the children
+	 */
+	void releaseBlock(void* children, unsigned int depth)
+	{
+		if (1 == depth)
+		{
+			LeafBlock* block = static_cast<LeafBlock*>(children);
+			if (1 == block->ref_count.fetch_sub(1, std::memory_order_acq_rel))
+			{
+				node_allocator_->deallocate(block);
+			}
+		}
+		else
+		{
+			InnerBlock* block = static_cast<InnerBlock*>(children);
+			if (1 == block->ref_count.fetch_sub(1, std::memory_order_acq_rel))
+			{
+				for (InnerNode<LEAF_NODE>& child : block->children)
+				{
+					if (nullptr != child.getChildren())
+					{
+						releaseBlock(child.getChildren(), depth - 1);
+					}
+				}
+				node_allocator_->deallocate(block, depth);
+			}
+		}
+	}
+
+	/**
+	 * @brief Drop a reference to children that concurrent readers can still be in. While
+	 * concurrency is enabled the reference is kept until the next prune(), so the children
+	 * are not freed under the readers when the copies sharing them are destroyed.
+	 *
+	 * @param children The children
+	 * @param depth The depth of the parent of the children
+	 */
+	void retireBlock(void* children, unsigned int depth)
+	{
+		if (!concurrency_enabled_)
+		{
+			releaseBlock(children, depth);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(retired_mutex_);
+		retired_blocks_.emplace_back(children, depth);
+	}
+
+	/**
+	 * @brief Drop the references kept by retireBlock
+	 *
+	 * @remark Has to be called while no other thread uses the octree
+	 */
+	void releaseRetiredBlocks()
+	{
+		for (auto [children, depth] : retired_blocks_)
+		{
+			releaseBlock(children, depth);
+		}
+		retired_blocks_.clear();
+	}
+
+	/**
+	 * @brief Make sure that the children of inner_node are not shared with a copy of the
+	 * octree, by copying them if they are. Has to be called before changing the children.
+	 */
+	void makeChildrenUnique(InnerNode<LEAF_NODE>& inner_node, unsigned int depth)
+	{
+		if (nullptr == inner_node.getChildren() ||
+				1 == getRefCount(inner_node, depth).load(std::memory_order_acquire))
+		{
+			return;
+		}
+
+		void* shared = inner_node.getChildren();
+		void* copy;
+		if (1 == depth)
+		{
+			LeafBlock* block = node_allocator_->allocateLeafBlock();
+			block->children = static_cast<LeafBlock*>(shared)->children;
+			copy = block;
+		}
+		else
+		{
+			InnerBlock* block = node_allocator_->allocateInnerBlock(depth);
+			block->children = static_cast<InnerBlock*>(shared)->children;
+			for (InnerNode<LEAF_NODE>& child : block->children)
+			{
+				if (nullptr != child.getChildren())
+				{
+					++getRefCount(child, depth - 1);
+				}
+			}
+			copy = block;
+		}
+
+		// Publishes the initialized copy to concurrent readers
+		inner_node.setChildren(copy);
+		retireBlock(shared, depth);
+	}
+
+	//
+	// Compaction
+	//
+
+	/**
+	 * @brief Move the descendants of inner_node that are in the old memory, in depth-first
+	 * order, starting with the subtree at compact_cursor_
+	 *
+	 * @param code The code of inner_node at depth 0
+	 * @param first_unit The code of the first subtree to move in this call
+	 * @return false If the deadline was reached, compact_cursor_ is then the next subtree
+	 */
+	bool compactRecurs(InnerNode<LEAF_NODE>& inner_node, unsigned int depth, uint64_t code,
+										 uint64_t first_unit,
+										 std::chrono::steady_clock::time_point deadline)
+	{
+		if (code + (uint64_t(1) << (3 * depth)) <= compact_cursor_)
+		{
+			// Moved by an earlier call
+			return true;
+		}
+
+		if (COMPACT_UNIT_DEPTH >= depth && first_unit != code &&
+				std::chrono::steady_clock::time_point::max() != deadline &&
+				std::chrono::steady_clock::now() >= deadline)
+		{
+			compact_cursor_ = code;
+			return false;
+		}
+
+		if (nullptr == inner_node.getChildren())
+		{
+			return true;
+		}
+
+		moveChildren(inner_node, depth);
+
+		if (1 == depth)
+		{
+			return true;
+		}
+
+		unsigned int child_depth = depth - 1;
+		auto& children =
+				*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.getChildren());
+		for (unsigned int i = 0; i < 8; ++i)
+		{
+			uint64_t child_code = code + (uint64_t(i) << (3 * child_depth));
+			if (!compactRecurs(children[i], child_depth, child_code, first_unit, deadline))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Move the children of inner_node to new memory, if they are in the old memory
+	 */
+	void moveChildren(InnerNode<LEAF_NODE>& inner_node, unsigned int depth)
+	{
+		if (1 == depth)
+		{
+			LeafBlock* block = static_cast<LeafBlock*>(inner_node.getChildren());
+			if (node_allocator_->isOld(block))
+			{
+				LeafBlock* moved = node_allocator_->allocateLeafBlock();
+				moved->children = block->children;
+				inner_node.setChildren(moved);
+				node_allocator_->deallocate(block);
+			}
+			return;
+		}
+
+		InnerBlock* block = static_cast<InnerBlock*>(inner_node.getChildren());
+		if (!node_allocator_->isOld(block, depth))
+		{
+			return;
+		}
+
+		// The children keep pointing at their own children, which are moved next
+		InnerBlock* moved = node_allocator_->allocateInnerBlock(depth);
+		moved->children = block->children;
+		inner_node.setChildren(moved);
+		node_allocator_->deallocate(block, depth);
+	}
+
+	/**
+	 * @brief Make the children of all nodes above min_depth unique
+	 */
+	void makeTopLevelsUnique(InnerNode<LEAF_NODE>& inner_node, unsigned int depth,
+													 unsigned int min_depth)
+	{
+		if (min_depth >= depth || nullptr == inner_node.getChildren())
+		{
+			return;
+		}
+
+		makeChildrenUnique(inner_node, depth);
+		for (InnerNode<LEAF_NODE>& child :
+				 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.getChildren()))
+		{
+			makeTopLevelsUnique(child, depth - 1, min_depth);
+		}
+	}
+
+	//
+	// Node collapsible
+	//
+
+	virtual bool isNodeCollapsible(const std::array<LEAF_NODE, 8>& children) const
+	{
+		for (int i = 1; i < 8; ++i)
+		{
+			// if (children[0].logit < children[i].logit - 0.1 ||
+			// 		children[0].logit > children[i].logit + 0.1)
+			if (children[0].logit != children[i].logit)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	virtual bool
+	isNodeCollapsible(const std::array<InnerNode<LEAF_NODE>, 8>& children) const
+	{
+		if (isLeaf(children[0]))
+		{
+			for (int i = 1; i < 8; ++i)
+			{
+				if (children[0].logit != children[i].logit || !isLeaf(children[i]))
+				{
+					return false;
+				}
+			}
+		}
+		else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	//
+	// Prune
+	//
+
+	void prune(InnerNode<LEAF_NODE>& inner_node, unsigned int current_depth)
+	{
+		if (nullptr == inner_node.getChildren())
+		{
+			return;
+		}
+
+		bool collapsible;
+		if (!hasChildren(inner_node))
+		{
+			collapsible = true;
+		}
+		else if (1 < getRefCount(inner_node, current_depth))
+		{
+			// Shared with a copy, pruning it would mean copying it
+			return;
+		}
+		else if (1 == current_depth)
+		{
+			collapsible = isNodeCollapsible(
+					*static_cast<std::array<LEAF_NODE, 8>*>(inner_node.getChildren()));
+		}
+		else
+		{
+			std::array<InnerNode<LEAF_NODE>, 8>& children =
+					*static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.getChildren());
+			unsigned int child_depth = current_depth - 1;
+			for (InnerNode<LEAF_NODE>& child : children)
+			{
+				prune(child, child_depth);
+			}
+			collapsible = isNodeCollapsible(children);
+		}
+
+		if (collapsible)
+		{
+			inner_node.contains_free = isFree(inner_node);
+			inner_node.contains_unknown = isUnknown(inner_node);
+			deleteChildren(inner_node, current_depth, true);
+		}
+	}
+
+	//
+	// Checking for children
+	//
+
+	bool isLeaf(const InnerNode<LEAF_NODE>& node) const
+	{
+		return node.allChildrenSame();
+	}
+
+	bool hasChildren(const InnerNode<LEAF_NODE>& node) const
+	{
+		// Pairs with the release in createChildren
+		return !node.allChildrenSame();
+	}
+
+	/**
+	 * @return true If all leaves under the node have the same logit as the node
+	 */
+	bool isUniform(const InnerNode<LEAF_NODE>& node) const
+	{
+		return node.uniform || !hasChildren(node);
+	}
+
+	//
+	// Random functions
+	//
+
+	bool containsOnlySameType(const LEAF_NODE& node) const
+	{
+		return true;
+	}
+
+	bool containsOnlySameType(const InnerNode<LEAF_NODE>& node) const
+	{
+		if (isOccupied(node))
+		{
+			return !containsFree(node) && !containsUnknown(node);
+		}
+		else if (isUnknown(node))
+		{
+			return !containsFree(node);
+		}
+		return true;  // Is free and does only contain free children
+	}
+
+	template <typename ORIGINS, typename CLOUD>
+	void addPointCloudImpl(const ORIGINS& sensor_origins, const CLOUD& cloud,
+												 float max_range)
+	{
+		if (!insert_session_active_)
+		{
+			throw std::invalid_argument("No insert session is active, call beginInsert first");
+		}
+
+		// Traced straight into indices_, a hit overrides misses from earlier point clouds
+		computeUpdate(sensor_origins, cloud, max_range);
+		insert_session_points_ += cloud.size();
+
+		if (0 != insert_session_budget_ && insert_session_budget_ <= insert_session_points_)
+		{
+			applyInsertSession();
+		}
+	}
+
+	void applyInsertSession()
+	{
+		updateNodeValues(indices_.begin(), indices_.end());
+		indices_.clear();
+		insert_session_points_ = 0;
+	}
+
+	template <typename ORIGINS, typename CLOUD>
+	void insertPointCloudImpl(const ORIGINS& sensor_origins, const CLOUD& cloud,
+														float max_range)
+	{
+		if (insert_session_active_)
+		{
+			throw std::invalid_argument("Cannot insert during an insert session");
+		}
+
+		if (concurrency_enabled_)
+		{
+			// The shared buffers cannot be used, each call gets its own
+			CodeMap<float> indices;
+			VisitedGrid visited;
+			computeUpdate(sensor_origins, cloud, 0, cloud.size(), max_range, {}, indices,
+										visited);
+			updateNodeValues(indices.begin(), indices.end());
+			return;
+		}
+
+		computeUpdate(sensor_origins, cloud, max_range);
+
+		// Insert
+		updateNodeValues(indices_.begin(), indices_.end());
+
+		indices_.clear();
+	}
+
+	// One depth of the hierarchy used by insertPointCloudDiscrete, stored as sorted codes
+	// with the children of codes[i] at [offsets[i], offsets[i + 1]) in the level below
+	struct DiscreteLevel
+	{
+		unsigned int depth;
+		std::vector<uint64_t> codes;
+		std::vector<size_t> offsets;
+	};
+
+	template <typename CLOUD>
+	void insertPointCloudDiscreteImpl(const Point3& sensor_origin, const CLOUD& cloud,
+																		float max_range, unsigned int n, unsigned int depth)
+	{
+		if (insert_session_active_)
+		{
+			throw std::invalid_argument("Cannot insert during an insert session");
+		}
+
+		// The shared buffers cannot be used concurrently, then each call gets its own
+		CodeMap<float> concurrent_indices;
+		std::vector<DiscreteLevel> concurrent_levels;
+		std::vector<uint64_t> concurrent_point_codes;
+		std::vector<uint64_t> concurrent_buffer;
+		CodeMap<float>& indices = concurrency_enabled_ ? concurrent_indices : indices_;
+		std::vector<DiscreteLevel>& levels =
+				concurrency_enabled_ ? concurrent_levels : discrete_levels_;
+		std::vector<uint64_t>& point_codes =
+				concurrency_enabled_ ? concurrent_point_codes : discrete_point_codes_;
+		std::vector<uint64_t>& buffer =
+				concurrency_enabled_ ? concurrent_buffer : discrete_buffer_;
+
+		// Level 0 of the hierarchy holds the ends of the rays, above that the levels hold
+		// the nodes at depth 1 to depth, or only at depth if n is 0
+		levels.resize(0 == depth ? 1 : (0 == n ? 2 : depth + 1));
+		for (size_t level = 0; level < levels.size(); ++level)
+		{
+			levels[level].depth = (0 == n && 0 != level) ? depth : level;
+			levels[level].codes.clear();
+			levels[level].offsets.clear();
+		}
+		std::vector<uint64_t>& discrete = levels[0].codes;
+
+		// The unique voxels of the points in Morton order, so the rays and the updates
+		// below are generated with spatial locality
+		coordsToCodes(cloud, point_codes);
+		radixSortUnique(point_codes, buffer, 64);
+
+		Point3 origin;
+		Point3 end;
+		float distance;
+		Point3 dir;
+		Key changed_end;
+		Point3 changed_point;
+		Key point_key;
+		for (uint64_t point_code : point_codes)
+		{
+			point_key = Code(point_code, 0).toKey();
+			changed_point = keyToCoord(point_key, 0);
+
+			origin = sensor_origin;
+			end = changed_point - origin;
+			distance = end.norm();
+			dir = end / distance;
+			if (0 <= max_range && distance > max_range)
+			{
+				end = origin + (dir * max_range);
+			}
+			else
+			{
+				end = changed_point;
+			}
+
+			// Move origin and end to inside BBX
+			if (!moveLineIntoBBX(origin, end))
 			{
-				inner_node.children = new std::array<LEAF_NODE, 8>();
+				// Line outside of BBX
+				continue;
 			}
-			for (LEAF_NODE& child :
-					 *static_cast<std::array<LEAF_NODE, 8>*>(inner_node.children))
+
+			changed_end = coordToKey(end, 0);
+			if (changed_point == end)
 			{
-				child.logit = inner_node.logit;
+				if (0 == n && 0 != depth)  // TODO: Why 0 == depth? Should it not be 0 !=
+																	 // depth
+				{
+					integrateHit(Code(changed_end));
+				}
+				else if (!indices.try_emplace(changed_end, prob_hit_log_).second)
+				{
+					continue;
+				}
 			}
-			num_leaf_nodes_ += 8;
-			num_inner_leaf_nodes_ -= 1;
-			num_inner_nodes_ += 1;
+
+			discrete.push_back(Code(changed_end).getCode());
 		}
-		else
+
+		// Ends moved by max range or the BBX are no longer in order
+		radixSortUnique(discrete, buffer, 3 * depth_levels_);
+
+		// The children of a node are next to each other since the codes are sorted
+		for (size_t level = 1; level < levels.size(); ++level)
 		{
-			if (nullptr == inner_node.children)
-			{
-				inner_node.children = new std::array<InnerNode<LEAF_NODE>, 8>();
-			}
-			for (InnerNode<LEAF_NODE>& child :
-					 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.children))
+			const std::vector<uint64_t>& children = levels[level - 1].codes;
+			std::vector<uint64_t>& codes = levels[level].codes;
+			std::vector<size_t>& offsets = levels[level].offsets;
+			unsigned int shift = 3 * levels[level].depth;
+			for (size_t i = 0; i < children.size(); ++i)
 			{
-				child.logit = inner_node.logit;
-				child.contains_free = inner_node.contains_free;
-				child.contains_unknown = inner_node.contains_unknown;
-				child.all_children_same = true;
-				// child.children = nullptr;
+				uint64_t code = (children[i] >> shift) << shift;
+				if (codes.empty() || codes.back() != code)
+				{
+					codes.push_back(code);
+					offsets.push_back(i);
+				}
 			}
-			num_inner_leaf_nodes_ += 7;  // Get 8 new and 1 is made into a inner node
-			num_inner_nodes_ += 1;
+			offsets.push_back(children.size());
 		}
-		inner_node.all_children_same = false;
+
+		computeUpdateDiscrete(sensor_origin, levels, indices, n);
+
+		// Insert
+		updateNodeValues(indices.begin(), indices.end());
+		indices.clear();
 	}
 
-	void deleteChildren(InnerNode<LEAF_NODE>& inner_node, unsigned int depth,
-											bool manual_pruning = false)
+	/**
+	 * @brief Sensor origin of point index when all points have the same origin
+	 */
+	static const Point3& sensorOrigin(const Point3& sensor_origin, size_t)
+	{
+		return sensor_origin;
+	}
+
+	/**
+	 * @brief Sensor origin of point index when each point has its own origin
+	 */
+	static const Point3& sensorOrigin(const std::vector<Point3>& sensor_origins,
+																		size_t index)
 	{
-		// TODO: Add mutex?
-		inner_node.all_children_same = true;
+		return sensor_origins[index];
+	}
 
-		if (nullptr == inner_node.children ||
-				(!manual_pruning && !automatic_pruning_enabled_))
+	template <typename ORIGINS, typename CLOUD>
+	void computeUpdate(const ORIGINS& sensor_origins, const CLOUD& cloud, float max_range,
+										 const std::vector<float>& depth_ranges = {})
+	{
+		size_t num_threads =
+				std::min(static_cast<size_t>(num_threads_), cloud.size() / MIN_POINTS_PER_THREAD);
+		if (1 >= num_threads)
 		{
+			computeUpdate(sensor_origins, cloud, 0, cloud.size(), max_range, depth_ranges,
+										indices_, visited_);
 			return;
 		}
 
-		if (1 == depth)
+		// The calling thread traces the first part directly into indices_
+		if (thread_indices_.size() < num_threads - 1)
 		{
-			delete static_cast<std::array<LEAF_NODE, 8>*>(inner_node.children);
-			inner_node.children = nullptr;
-			num_leaf_nodes_ -= 8;
-			num_inner_leaf_nodes_ += 1;
-			num_inner_nodes_ -= 1;
+			thread_indices_.resize(num_threads - 1);
 		}
-		else
+		if (thread_visited_.size() < num_threads - 1)
 		{
-			std::array<InnerNode<LEAF_NODE>, 8>* children =
-					static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.children);
-			unsigned int child_depth = depth - 1;
-			for (InnerNode<LEAF_NODE>& child : *children)
-			{
-				deleteChildren(child, child_depth);
-			}
-			delete children;
-			inner_node.children = nullptr;
-			num_inner_leaf_nodes_ -=
-					7;  // Remove 8 and 1 inner node is made into a inner leaf node
-			num_inner_nodes_ -= 1;
+			thread_visited_.resize(num_threads - 1);
 		}
-	}
 
-	//
-	// Node collapsible
-	//
+		size_t points_per_thread = cloud.size() / num_threads;
+		std::vector<std::thread> threads;
+		threads.reserve(num_threads - 1);
+		for (size_t i = 1; i < num_threads; ++i)
+		{
+			size_t first = i * points_per_thread;
+			size_t last = (num_threads - 1 == i) ? cloud.size() : first + points_per_thread;
+			threads.emplace_back(
+					[this, &sensor_origins, &cloud, first, last, max_range, &depth_ranges, i]() {
+						computeUpdate(sensor_origins, cloud, first, last, max_range, depth_ranges,
+													thread_indices_[i - 1], thread_visited_[i - 1]);
+					});
+		}
+		computeUpdate(sensor_origins, cloud, 0, points_per_thread, max_range, depth_ranges,
+									indices_, visited_);
 
-	virtual bool isNodeCollapsible(const std::array<LEAF_NODE, 8>& children) const
-	{
-		for (int i = 1; i < 8; ++i)
+		for (std::thread& thread : threads)
 		{
-			// if (children[0].logit < children[i].logit - 0.1 ||
-			// 		children[0].logit > children[i].logit + 0.1)
-			if (children[0].logit != children[i].logit)
-			{
-				return false;
-			}
+			thread.join();
 		}
-		return true;
+
+		mergeThreadIndices(indices_, num_threads - 1);
 	}
 
-	virtual bool
-	isNodeCollapsible(const std::array<InnerNode<LEAF_NODE>, 8>& children) const
+	/**
+	 * @brief Merge and clear the first num thread_indices_ into indices, a hit overrides a
+	 * miss
+	 */
+	void mergeThreadIndices(CodeMap<float>& indices, size_t num)
 	{
-		if (isLeaf(children[0]))
+		for (size_t i = 0; i < num; ++i)
 		{
-			for (int i = 1; i < 8; ++i)
+			for (const auto& [code, value] : thread_indices_[i])
 			{
-				if (children[0].logit != children[i].logit || !isLeaf(children[i]))
+				auto [it, inserted] = indices.try_emplace(code, value);
+				if (!inserted && prob_hit_log_ == value)
 				{
-					return false;
+					it->second = value;
 				}
 			}
+			thread_indices_[i].clear();
 		}
-		else
-		{
-			return false;
-		}
-
-		return true;
 	}
 
-	//
-	// Clear
-	//
-
-	void clear(InnerNode<LEAF_NODE>& inner_node, unsigned int current_depth)
+	template <typename ORIGINS, typename CLOUD>
+	void computeUpdate(const ORIGINS& sensor_origins, const CLOUD& cloud, size_t first,
+										 size_t last, float max_range, const std::vector<float>& depth_ranges,
+										 CodeMap<float>& indices, VisitedGrid& visited) const
 	{
-		if (nullptr == inner_node.children)
+		if (first >= last)
 		{
 			return;
 		}
 
-		if (1 < current_depth)
+		if (!depth_ranges.empty())
 		{
-			unsigned int child_depth = current_depth - 1;
-			for (InnerNode<LEAF_NODE>& child :
-					 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(inner_node.children))
+			computeUpdateAdaptive(sensor_origins, cloud, first, last, max_range, depth_ranges,
+														indices, visited);
+			return;
+		}
+
+		// Source: A Faster Voxel Traversal Algorithm for Ray Tracing
+
+		// The misses are traversed RayBatch::SIZE rays at a time
+		RayBatch rays;
+		// Voxels close to the sensor are only added to indices the first time, the rays
+		// still step through them
+		visited.reset(coordToKey(sensorOrigin(sensor_origins, first), 0));
+
+		for (size_t i = first; i < last; ++i)
+		{
+			Point3 origin = sensorOrigin(sensor_origins, i);
+			Point3 end = cloud[i] - origin;
+			float distance = end.norm();
+			Point3 dir = end / distance;
+			if (0 <= max_range && distance > max_range)
+			{
+				end = origin + (dir * max_range);
+			}
+			else
 			{
-				clear(child, child_depth);
+				end = cloud[i];
 			}
-		}
 
-		deleteChildren(inner_node, current_depth, true);
-	}
+			// Move origin and end to inside BBX
+			if (!moveLineIntoBBX(origin, end))
+			{
+				// Line outside of BBX
+				continue;
+			}
 
-	//
-	// Checking for children
-	//
+			if (cloud[i] == end)
+			{
+				indices[Code(coordToKey(end, 0))] = prob_hit_log_;
+			}
 
-	bool isLeaf(const InnerNode<LEAF_NODE>& node) const
-	{
-		return node.all_children_same;
-	}
+			Key current;
+			Key ending;
 
-	bool hasChildren(const InnerNode<LEAF_NODE>& node) const
-	{
-		return !node.all_children_same;
-	}
+			std::array<int, 3> step;
+			Point3 t_delta;
+			Point3 t_max;
 
-	//
-	// Random functions
-	//
+			computeRayInit(origin, end, dir, current, ending, step, t_delta, t_max);
 
-	bool containsOnlySameType(const LEAF_NODE& node) const
-	{
-		return true;
+			if (current == ending)
+			{
+				continue;
+			}
+
+			rays.add(current, ending, step, t_delta, t_max, distance);
+			if (rays.full())
+			{
+				rays.traverse([this, &indices, &visited](size_t, const Key& key) {
+					if (visited.insert(key))
+					{
+						indices.try_emplace(key, prob_miss_log_);
+					}
+				});
+				rays.clear();
+			}
+		}
+
+		// Increment the rays that are left
+		rays.traverse([this, &indices, &visited](size_t, const Key& key) {
+			if (visited.insert(key))
+			{
+				indices.try_emplace(key, prob_miss_log_);
+			}
+		});
 	}
 
-	bool containsOnlySameType(const InnerNode<LEAF_NODE>& node) const
+	template <typename ORIGINS, typename CLOUD>
+	void computeUpdateAdaptive(const ORIGINS& sensor_origins, const CLOUD& cloud,
+														 size_t first, size_t last, float max_range,
+														 const std::vector<float>& depth_ranges,
+														 CodeMap<float>& indices, VisitedGrid& visited) const
 	{
-		if (isOccupied(node))
-		{
-			return !containsFree(node) && !containsUnknown(node);
-		}
-		else if (isUnknown(node))
+		// One batch per depth, since all rays in a batch have to be at the same depth
+		std::vector<RayBatch> rays(depth_ranges.size() + 1);
+		std::vector<float> values(depth_ranges.size() + 1);
+		for (unsigned int depth = 0; depth < values.size(); ++depth)
 		{
-			return !containsFree(node);
+			values[depth] = prob_miss_log_ / float((2.0 * depth) + 1);
 		}
-		return true;  // Is free and does only contain free children
-	}
 
-	void computeUpdate(const Point3& sensor_origin, const PointCloud& cloud,
-										 float max_range)
-	{
-		// Source: A Faster Voxel Traversal Algorithm for Ray Tracing
+		// Voxels close to the sensor are only added to indices the first time, the rays
+		// still step through them
+		visited.reset(coordToKey(sensorOrigin(sensor_origins, first), 0));
+
+		auto traverse = [&indices, &values, &visited](RayBatch& batch, unsigned int depth) {
+			float value = values[depth];
+			batch.traverse([&indices, &visited, value, depth](size_t, const Key& key) {
+				if (0 != depth || visited.insert(key))
+				{
+					indices.try_emplace(Code(key).toDepth(depth), value);
+				}
+			});
+			batch.clear();
+		};
 
-		for (size_t i = 0; i < cloud.size(); ++i)
+		for (size_t i = first; i < last; ++i)
 		{
+			const Point3& sensor_origin = sensorOrigin(sensor_origins, i);
 			Point3 origin = sensor_origin;
 			Point3 end = cloud[i] - origin;
 			float distance = end.norm();
@@ -2231,35 +4234,202 @@ protected:
 
 			if (cloud[i] == end)
 			{
-				indices_[Code(coordToKey(end, 0))] = prob_hit_log_;
+				indices[Code(coordToKey(end, 0))] = prob_hit_log_;
 			}
 
-			Key current;
-			Key ending;
+			// Distances along the ray from the sensor origin
+			float segment_begin = (origin - sensor_origin).norm();
+			float ray_end = (end - sensor_origin).norm();
 
-			std::array<int, 3> step;
-			Point3 t_delta;
-			Point3 t_max;
+			for (unsigned int depth = 0; depth < rays.size() && segment_begin < ray_end; ++depth)
+			{
+				float segment_end =
+						depth < depth_ranges.size() ? std::min(depth_ranges[depth], ray_end) : ray_end;
+				if (segment_end <= segment_begin)
+				{
+					continue;
+				}
 
-			computeRayInit(origin, end, dir, current, ending, step, t_delta, t_max);
+				Point3 segment_origin = sensor_origin + (dir * segment_begin);
+				Point3 segment_end_point =
+						ray_end == segment_end ? end : sensor_origin + (dir * segment_end);
+
+				Key current;
+				Key ending;
+
+				std::array<int, 3> step;
+				Point3 t_delta;
+				Point3 t_max;
+
+				computeRayInit(segment_origin, segment_end_point, dir, current, ending, step,
+											 t_delta, t_max, depth);
+
+				segment_begin = segment_end;
+
+				if (current == ending)
+				{
+					continue;
+				}
+
+				rays[depth].add(current, ending, step, t_delta, t_max,
+												(segment_end_point - segment_origin).norm());
+				if (rays[depth].full())
+				{
+					traverse(rays[depth], depth);
+				}
+			}
+		}
+
+		// Increment the rays that are left
+		for (unsigned int depth = 0; depth < rays.size(); ++depth)
+		{
+			traverse(rays[depth], depth);
+		}
+	}
+
+	/**
+	 * @brief Add misses for the free space seen by sensor in the node code, at the coarsest
+	 * depth where a node is completely free
+	 *
+	 * @details A coarse miss is applied by updateNodeValueRecurs to the node itself, which
+	 * deletes the children if the node is no longer occupied. Voxels are classified by
+	 * where their center projects into the image, not by the rays that pass through them.
+	 */
+	template <typename SENSOR>
+	void computeUpdateProjective(const SENSOR& sensor, const Code& code,
+															 CodeMap<float>& indices) const
+	{
+		unsigned int depth = code.getDepth();
+		Point3 center = keyToCoord(code.toKey());
+
+		if (0 == depth)
+		{
+			if (sensor.isFree(center) && inBBX(center))
+			{
+				indices.try_emplace(code, prob_miss_log_);
+			}
+			return;
+		}
+
+		float half_size = getNodeHalfSize(depth);
+		Point3 half(half_size, half_size, half_size);
+		if (isBBXLimitEnabled() &&
+				!ufomap_geometry::intersects(ufomap_geometry::AABB(center - half, center + half),
+																		 ufomap_geometry::AABB(getBBXMin(), getBBXMax())))
+		{
+			return;
+		}
+
+		switch (sensor.classify(center, half_size))
+		{
+			case Visibility::UNSEEN:
+				return;
+			case Visibility::FREE:
+				if (inBBX(center - half) && inBBX(center + half))
+				{
+					// Updated at this depth, not per voxel
+					indices.try_emplace(code, prob_miss_log_);
+					return;
+				}
+				break;
+			case Visibility::PARTIAL:
+				break;
+		}
+
+		for (unsigned int i = 0; i < 8; ++i)
+		{
+			computeUpdateProjective(sensor, code.getChild(i), indices);
+		}
+	}
+
+	/**
+	 * @brief Remove the coarse misses in indices that contain a hit, so the free space of a
+	 * point cloud does not clear its own hits.
+	 */
+	void removeMissesContainingHits(CodeMap<float>& indices,
+																	unsigned int max_depth) const
+	{
+		std::vector<Code> hits;
+		for (const auto& [code, value] : indices)
+		{
+			if (0 == code.getDepth() && prob_hit_log_ == value)
+			{
+				hits.push_back(code);
+			}
+		}
 
-			// Increment
-			while (current != ending && t_max.min() <= distance)
+		for (const Code& hit : hits)
+		{
+			for (unsigned int depth = 1; depth <= max_depth; ++depth)
 			{
-				indices_.try_emplace(current, prob_miss_log_);
-				computeRayTakeStep(current, step, t_delta, t_max);
+				indices.erase(hit.toDepth(depth));
 			}
 		}
 	}
 
-	void computeUpdateDiscrete(const Point3& sensor_origin, const std::vector<Key>& current,
-														 const KeyMap<std::vector<Key>>& discrete_map,
-														 unsigned int n = 0)
+	/**
+	 * @brief Trace the rays of the discrete hierarchy, in parallel over the nodes of the
+	 * top level when not in concurrency mode
+	 */
+	void computeUpdateDiscrete(const Point3& sensor_origin,
+														 const std::vector<DiscreteLevel>& levels,
+														 CodeMap<float>& indices, unsigned int n)
+	{
+		size_t top = levels.size() - 1;
+		size_t num_nodes = levels[top].codes.size();
+		size_t num_threads =
+				concurrency_enabled_ ? 1 :
+															 std::min(static_cast<size_t>(num_threads_),
+																				levels[0].codes.size() / MIN_POINTS_PER_THREAD);
+		num_threads = std::min(num_threads, num_nodes);
+		if (1 >= num_threads)
+		{
+			computeUpdateDiscrete(sensor_origin, levels, top, 0, num_nodes, indices, n);
+			return;
+		}
+
+		if (thread_indices_.size() < num_threads - 1)
+		{
+			thread_indices_.resize(num_threads - 1);
+		}
+
+		size_t nodes_per_thread = num_nodes / num_threads;
+		std::vector<std::thread> threads;
+		threads.reserve(num_threads - 1);
+		for (size_t i = 1; i < num_threads; ++i)
+		{
+			size_t first = i * nodes_per_thread;
+			size_t last = (num_threads - 1 == i) ? num_nodes : first + nodes_per_thread;
+			threads.emplace_back([this, &sensor_origin, &levels, top, first, last, n, i]() {
+				computeUpdateDiscrete(sensor_origin, levels, top, first, last,
+															thread_indices_[i - 1], n);
+			});
+		}
+		computeUpdateDiscrete(sensor_origin, levels, top, 0, nodes_per_thread, indices, n);
+
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		mergeThreadIndices(indices, num_threads - 1);
+	}
+
+	/**
+	 * @brief Trace the rays to the nodes [first, last) of a level of the discrete hierarchy
+	 */
+	void computeUpdateDiscrete(const Point3& sensor_origin,
+														 const std::vector<DiscreteLevel>& levels, size_t level,
+														 size_t first, size_t last, CodeMap<float>& indices,
+														 unsigned int n) const
 	{
 		// Source: A Faster Voxel Traversal Algorithm for Ray Tracing
 
-		for (const auto& key : current)
+		const DiscreteLevel& current_level = levels[level];
+		for (size_t index = first; index < last; ++index)
 		{
+			Key key = Code(current_level.codes[index], current_level.depth).toKey();
+
 			Point3 origin = sensor_origin;
 			Point3 end = keyToCoord(key) - sensor_origin;
 			float distance = end.norm();
@@ -2281,7 +4451,7 @@ protected:
 				// Increment
 				while (current != ending && t_max.min() <= distance)
 				{
-					indices_.try_emplace(current, prob_miss_log_);
+					indices.try_emplace(current, prob_miss_log_);
 					computeRayTakeStep(current, step, t_delta, t_max, key.getDepth());
 				}
 			}
@@ -2298,7 +4468,7 @@ protected:
 				while (current_key != key && step <= num_steps)
 				{
 					last = current;
-					indices_.try_emplace(current_key, value);
+					indices.try_emplace(current_key, value);
 					current += (dir * node_size);
 					current_key = coordToKey(current, key.getDepth());
 					++step;
@@ -2306,11 +4476,12 @@ protected:
 
 				if (0 == n)
 				{
-					indices_.try_emplace(current_key, value);
+					indices.try_emplace(current_key, value);
 				}
 				else
 				{
-					computeUpdateDiscrete(last, discrete_map.at(key), discrete_map, n);
+					computeUpdateDiscrete(last, levels, level - 1, current_level.offsets[index],
+																current_level.offsets[index + 1], indices, n);
 				}
 			}
 		}
@@ -2621,7 +4792,7 @@ protected:
 	{
 		static_cast<LEAF_NODE&>(node).readData(s, occupancy_thres_log, free_thres_log,
 																					 from_octomap);
-		node.all_children_same = true;
+		node.setAllChildrenSame(true);
 
 		char children_char;
 		s.read((char*)&children_char, sizeof(char));
@@ -2635,7 +4806,8 @@ protected:
 
 			if (1 == current_depth)
 			{
-				for (LEAF_NODE& child : *static_cast<std::array<LEAF_NODE, 8>*>(node.children))
+				for (LEAF_NODE& child :
+						 *static_cast<std::array<LEAF_NODE, 8>*>(node.getChildren()))
 				{
 					child.readData(s, occupancy_thres_log, free_thres_log, from_octomap);
 				}
@@ -2643,7 +4815,7 @@ protected:
 			else
 			{
 				for (InnerNode<LEAF_NODE>& child :
-						 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(node.children))
+						 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(node.getChildren()))
 				{
 					readNodesRecurs(s, child, current_depth - 1, occupancy_thres_log,
 													free_thres_log, from_octomap);
@@ -2686,7 +4858,7 @@ protected:
 			if (1 == current_depth)
 			{
 				for (const LEAF_NODE& child :
-						 *static_cast<std::array<LEAF_NODE, 8>*>(node.children))
+						 *static_cast<std::array<LEAF_NODE, 8>*>(node.getChildren()))
 				{
 					child.writeData(s, occupancy_thres_log_, free_thres_log_, to_octomap);
 				}
@@ -2694,7 +4866,7 @@ protected:
 			else
 			{
 				for (const InnerNode<LEAF_NODE>& child :
-						 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(node.children))
+						 *static_cast<std::array<InnerNode<LEAF_NODE>, 8>*>(node.getChildren()))
 				{
 					writeNodesRecurs(s, child, current_depth - 1, to_octomap);
 				}
@@ -2745,13 +4917,62 @@ protected:
 	// Automatic pruning
 	bool automatic_pruning_enabled_ = true;
 
+	// Call updateLeafData from updateNodeValues
+	bool update_leaf_data_ = false;
+
+	// Saturation skipping
+	bool saturation_skipping_enabled_ = true;     // Skip updates of clamped subtrees
+	std::atomic<size_t> num_skipped_updates_{ 0 };  // Updates that changed nothing
+
 	// Memory
-	size_t num_inner_nodes_ = 0;
-	size_t num_inner_leaf_nodes_ = 1;  // The root node
-	size_t num_leaf_nodes_ = 0;
+	std::atomic<size_t> num_inner_nodes_{ 0 };
+	std::atomic<size_t> num_inner_leaf_nodes_{ 1 };  // The root node
+	std::atomic<size_t> num_leaf_nodes_{ 0 };
+	// Owns the children of all inner nodes, shared with the copies of the octree
+	std::shared_ptr<NodeAllocator<LEAF_NODE>> node_allocator_;
 
 	// Defined here for speedup
-	CodeMap<float> indices_;  // Used in insertPointCloud
+	CodeMap<float> indices_;                            // Used in insertPointCloud
+	std::vector<std::pair<Code, float>> update_batch_;  // Used in updateNodeValues
+	std::vector<std::pair<Code, float>> sort_buffer_;   // Used in sortUpdateBatch
+
+	// Used in insertPointCloudDiscrete
+	std::vector<DiscreteLevel> discrete_levels_;
+	std::vector<uint64_t> discrete_point_codes_;
+	std::vector<uint64_t> discrete_buffer_;
+
+	// Used in insertDepthImage and insertRangeImage
+	std::vector<float> clipped_;
+	DepthPyramid pyramid_;
+
+	// Insert session
+	bool insert_session_active_ = false;
+	size_t insert_session_budget_ = 0;  // Points before an automatic commit, 0 for none
+	size_t insert_session_points_ = 0;  // Points added since the last commit
+
+	// Multi-threaded insertion
+	unsigned int num_threads_ = 1;                // Number of threads used for ray tracing
+	std::vector<CodeMap<float>> thread_indices_;  // Per thread updates, merged into indices_
+	VisitedGrid visited_;                         // Near-sensor voxels traced into indices_
+	std::vector<VisitedGrid> thread_visited_;     // Near-sensor voxels per thread
+	inline static const size_t MIN_POINTS_PER_THREAD = 256;
+	// Smaller update batches are sorted with std::sort
+	inline static const size_t MIN_RADIX_SORT_SIZE = 1024;
+
+	// Concurrency
+	bool concurrency_enabled_ = false;
+	std::unique_ptr<std::mutex[]> subtree_mutexes_;  // One for each subtree
+	mutable std::mutex top_mutex_;     // For the levels above the subtrees
+	mutable std::mutex change_mutex_;  // For changed_codes_
+	std::mutex retired_mutex_;         // For retired_blocks_
+	// Children replaced while concurrent, with the depth of their parent. Freed by prune()
+	std::vector<std::pair<void*, unsigned int>> retired_blocks_;
+	inline static const unsigned int CONCURRENT_LEVELS = 3;
+
+	// Compaction
+	uint64_t compact_cursor_ = 0;  // Code of the next subtree to move
+	// The compaction can stop between subtrees at this depth
+	inline static const unsigned int COMPACT_UNIT_DEPTH = 4;
 
 	// File headers
 	inline static const std::string FILE_HEADER = "# UFOMap octree file";
@@ -0,0 +1,81 @@
+#ifndef UFOMAP_OCTREE_QUANTIZED_H
+#define UFOMAP_OCTREE_QUANTIZED_H
+
+#include <ufomap/node.h>
+#include <ufomap/octree_base.h>
+#include <ufomap/types.h>
+
+#include <memory>
+#include <string>
+
+namespace ufomap
+{
+/**
+ * @brief An occupancy octree with the logits stored as fixed-point integers
+ *
+ * @details Same API as Octree. The hit, miss and clamping logits are rounded to values
+ * the nodes can store at construction, so clamped nodes are exactly at the thresholds.
+ * Reads and writes the same files as Octree, except for the binary format which is not
+ * supported.
+ *
+ * @tparam LEAF_NODE OccupancyNodeQ8 or OccupancyNodeQ16
+ */
+template <typename LEAF_NODE>
+class OctreeQuantized : public OctreeBase<LEAF_NODE>
+{
+public:
+	OctreeQuantized(float resolution = 0.1, unsigned int depth_levels = 16,
+									bool automatic_pruning = true, float occupancy_thres = 0.5,
+									float free_thres = 0.5, float prob_hit = 0.7, float prob_miss = 0.4,
+									float clamping_thres_min = 0.1192, float clamping_thres_max = 0.971)
+		: OctreeBase<LEAF_NODE>(resolution, depth_levels, automatic_pruning, occupancy_thres,
+														free_thres, prob_hit, prob_miss, clamping_thres_min,
+														clamping_thres_max)
+	{
+	}
+
+	OctreeQuantized(const std::string& filename) : OctreeQuantized()
+	{
+		this->read(filename);
+	}
+
+	OctreeQuantized(const OctreeQuantized& other) : OctreeBase<LEAF_NODE>(other)
+	{
+	}
+
+	/**
+	 * @brief Get a frozen copy of the octree in constant time. The copy shares its nodes
+	 * with this octree until this octree changes them.
+	 */
+	std::shared_ptr<const OctreeQuantized> snapshot() const
+	{
+		return std::make_shared<const OctreeQuantized>(*this);
+	}
+
+	virtual ~OctreeQuantized()
+	{
+	}
+
+	//
+	// Tree type
+	//
+
+	virtual std::string getTreeType() const override
+	{
+		// Same data as Octree
+		return "Octree";
+	}
+
+	virtual std::string getTreeTypeOctomap() const override
+	{
+		return "OcTree";
+	}
+};
+
+// 1 byte per leaf, logits in [-4, 3.97] with a step of 1/32
+using OctreeQ8 = OctreeQuantized<OccupancyNodeQ8>;
+// 2 bytes per leaf, logits in [-32, 32) with a step of 1/1024
+using OctreeQ16 = OctreeQuantized<OccupancyNodeQ16>;
+}  // namespace ufomap
+
+#endif  // UFOMAP_OCTREE_QUANTIZED_H
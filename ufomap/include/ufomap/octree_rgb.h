@@ -5,6 +5,9 @@
 #include <ufomap/octree_base.h>
 #include <ufomap/types.h>
 
+#include <cmath>
+#include <cstdint>
+
 namespace ufomap
 {
 class OctreeRGB : public OctreeBase<OccupancyNodeRGB>
@@ -42,6 +45,15 @@ public:
 	 */
 	OctreeRGB(const OctreeRGB& other);
 
+	/**
+	 * @brief Get a frozen copy of the octree in constant time. The copy shares its nodes
+	 * with this octree until this octree changes them.
+	 */
+	std::shared_ptr<const OctreeRGB> snapshot() const
+	{
+		return std::make_shared<const OctreeRGB>(*this);
+	}
+
 	/**
 	 * @brief Destructor
 	 *
@@ -263,6 +275,54 @@ public:
 	}
 
 protected:
+	/**
+	 * @brief Running sum of the squared colors of the points in a voxel
+	 *
+	 */
+	struct ColorSum
+	{
+		uint64_t r = 0;
+		uint64_t g = 0;
+		uint64_t b = 0;
+		uint32_t count = 0;
+		bool applied = false;
+
+		void add(const Color& color)
+		{
+			r += static_cast<uint64_t>(color.r) * color.r;
+			g += static_cast<uint64_t>(color.g) * color.g;
+			b += static_cast<uint64_t>(color.b) * color.b;
+			++count;
+		}
+
+		/**
+		 * @return Color The same average as getAverageColor
+		 */
+		Color average() const
+		{
+			double num_colors = static_cast<double>(count);
+			return Color(std::sqrt(r / num_colors), std::sqrt(g / num_colors),
+									 std::sqrt(b / num_colors));
+		}
+	};
+
+	//
+	// Integrate color
+	//
+
+	/**
+	 * @brief The color of node after integrating color, weighted by the occupancy
+	 * probability of the node
+	 */
+	Color getIntegratedColor(const OccupancyNodeRGB& node, const Color& color) const;
+
+	//
+	// Update leaf data
+	//
+
+	virtual bool updateLeafData(OccupancyNodeRGB& leaf, const Code& code,
+															float logit_update) override;
+
 	//
 	// Set node color recurs
 	//
@@ -316,6 +376,9 @@ protected:
 
 protected:
 	bool prune_consider_color_ = false;
+
+	// Color of each voxel hit by the point cloud being inserted, used in updateLeafData
+	CodeMap<ColorSum> color_sums_;
 };
 }  // namespace ufomap
 
@@ -28,10 +28,16 @@ public:
 		push_back(other);
 	}
 
+	PointCloudT(PointCloudT&& other) = default;
+
 	~PointCloudT()
 	{
 	}
 
+	PointCloudT& operator=(const PointCloudT& other) = default;
+
+	PointCloudT& operator=(PointCloudT&& other) = default;
+
 	/**
 	 * @brief Access specified point
 	 *
@@ -0,0 +1,406 @@
+#ifndef UFOMAP_POINT_CLOUD_SOA_H
+#define UFOMAP_POINT_CLOUD_SOA_H
+
+#include <immintrin.h>  // x86intrin
+#include <ufomap/color.h>
+#include <ufomap/math/pose6.h>
+#include <ufomap/point_cloud.h>
+#include <ufomap/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace ufomap
+{
+/**
+ * @brief A rigid-body transformation as a rotation matrix and a translation
+ *
+ * @details Pose6::transform does two quaternion products per point. Here the quaternion
+ * is converted to a matrix once, after which each point is nine multiplications.
+ *
+ */
+class RigidTransform
+{
+public:
+	RigidTransform(const ufomap_math::Pose6& pose) : translation_(pose.translation())
+	{
+		std::vector<float> rotation;
+		pose.rotation().toRotMatrix(rotation);
+		std::copy(rotation.begin(), rotation.end(), rotation_.begin());
+	}
+
+	/**
+	 * @brief Transform a single point
+	 */
+	Point3 operator()(const Point3& point) const
+	{
+		return Point3((rotation_[0] * point[0]) + (rotation_[1] * point[1]) +
+											(rotation_[2] * point[2]) + translation_[0],
+									(rotation_[3] * point[0]) + (rotation_[4] * point[1]) +
+											(rotation_[5] * point[2]) + translation_[1],
+									(rotation_[6] * point[0]) + (rotation_[7] * point[1]) +
+											(rotation_[8] * point[2]) + translation_[2]);
+	}
+
+	/**
+	 * @brief Transform num points stored as structure of arrays
+	 *
+	 * @remark The input and output arrays can be the same
+	 */
+	void operator()(const float* x, const float* y, const float* z, float* x_out,
+									float* y_out, float* z_out, size_t num) const
+	{
+		size_t i = 0;
+#if defined(__AVX2__)
+		const __m256 r0 = _mm256_set1_ps(rotation_[0]);
+		const __m256 r1 = _mm256_set1_ps(rotation_[1]);
+		const __m256 r2 = _mm256_set1_ps(rotation_[2]);
+		const __m256 r3 = _mm256_set1_ps(rotation_[3]);
+		const __m256 r4 = _mm256_set1_ps(rotation_[4]);
+		const __m256 r5 = _mm256_set1_ps(rotation_[5]);
+		const __m256 r6 = _mm256_set1_ps(rotation_[6]);
+		const __m256 r7 = _mm256_set1_ps(rotation_[7]);
+		const __m256 r8 = _mm256_set1_ps(rotation_[8]);
+		const __m256 tx = _mm256_set1_ps(translation_[0]);
+		const __m256 ty = _mm256_set1_ps(translation_[1]);
+		const __m256 tz = _mm256_set1_ps(translation_[2]);
+		for (; i + 8 <= num; i += 8)
+		{
+			__m256 px = _mm256_loadu_ps(x + i);
+			__m256 py = _mm256_loadu_ps(y + i);
+			__m256 pz = _mm256_loadu_ps(z + i);
+			__m256 nx = _mm256_add_ps(
+					_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r0, px), _mm256_mul_ps(r1, py)),
+												_mm256_mul_ps(r2, pz)),
+					tx);
+			__m256 ny = _mm256_add_ps(
+					_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r3, px), _mm256_mul_ps(r4, py)),
+												_mm256_mul_ps(r5, pz)),
+					ty);
+			__m256 nz = _mm256_add_ps(
+					_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r6, px), _mm256_mul_ps(r7, py)),
+												_mm256_mul_ps(r8, pz)),
+					tz);
+			_mm256_storeu_ps(x_out + i, nx);
+			_mm256_storeu_ps(y_out + i, ny);
+			_mm256_storeu_ps(z_out + i, nz);
+		}
+#endif
+		for (; i < num; ++i)
+		{
+			Point3 point = (*this)(Point3(x[i], y[i], z[i]));
+			x_out[i] = point[0];
+			y_out[i] = point[1];
+			z_out[i] = point[2];
+		}
+	}
+
+	const std::array<float, 9>& rotation() const
+	{
+		return rotation_;
+	}
+
+	const Point3& translation() const
+	{
+		return translation_;
+	}
+
+private:
+	std::array<float, 9> rotation_;  // Row-major rotation matrix
+	Point3 translation_;
+};
+
+/**
+ * @brief A point cloud stored as structure of arrays, one array per coordinate
+ *
+ * @details Colors and intensities are optional columns, they are empty until enabled or
+ * until a point with color/intensity is added.
+ *
+ */
+class PointCloudSoA
+{
+public:
+	PointCloudSoA()
+	{
+	}
+
+	explicit PointCloudSoA(const PointCloud& cloud)
+	{
+		reserve(cloud.size());
+		for (const Point3& point : cloud)
+		{
+			push_back(point);
+		}
+	}
+
+	explicit PointCloudSoA(const PointCloudRGB& cloud)
+	{
+		reserve(cloud.size());
+		enableColor();
+		for (const Point3RGB& point : cloud)
+		{
+			push_back(point, point.getColor());
+		}
+	}
+
+	explicit PointCloudSoA(const PointCloudI& cloud)
+	{
+		reserve(cloud.size());
+		enableIntensity();
+		for (const Point3I& point : cloud)
+		{
+			push_back(point, point.getIntensity());
+		}
+	}
+
+	/**
+	 * @brief Get a point
+	 *
+	 * @param index Index of the point
+	 * @return Point3 A copy of the point
+	 */
+	inline Point3 operator[](size_t index) const
+	{
+		return Point3(x_[index], y_[index], z_[index]);
+	}
+
+	inline size_t size() const
+	{
+		return x_.size();
+	}
+
+	inline bool empty() const
+	{
+		return x_.empty();
+	}
+
+	inline void clear()
+	{
+		x_.clear();
+		y_.clear();
+		z_.clear();
+		color_.clear();
+		intensity_.clear();
+	}
+
+	inline void reserve(size_t new_cap)
+	{
+		x_.reserve(new_cap);
+		y_.reserve(new_cap);
+		z_.reserve(new_cap);
+		if (hasColor())
+		{
+			color_.reserve(new_cap);
+		}
+		if (hasIntensity())
+		{
+			intensity_.reserve(new_cap);
+		}
+	}
+
+	/**
+	 * @brief Adds a point, with white color and zero intensity if those columns are
+	 * enabled
+	 */
+	inline void push_back(const Point3& point)
+	{
+		x_.push_back(point[0]);
+		y_.push_back(point[1]);
+		z_.push_back(point[2]);
+		if (hasColor())
+		{
+			color_.emplace_back(255, 255, 255);
+		}
+		if (hasIntensity())
+		{
+			intensity_.push_back(0.0);
+		}
+	}
+
+	/**
+	 * @brief Adds a point with color, enables the color column
+	 */
+	inline void push_back(const Point3& point, const Color& color)
+	{
+		enableColor();
+		push_back(point);
+		color_.back() = color;
+	}
+
+	/**
+	 * @brief Adds a point with intensity, enables the intensity column
+	 */
+	inline void push_back(const Point3& point, float intensity)
+	{
+		enableIntensity();
+		push_back(point);
+		intensity_.back() = intensity;
+	}
+
+	/**
+	 * @brief Adds all points from another point cloud. Columns that only one of the point
+	 * clouds has are enabled and get default values.
+	 */
+	inline void push_back(const PointCloudSoA& other)
+	{
+		if (other.hasColor())
+		{
+			enableColor();
+		}
+		if (other.hasIntensity())
+		{
+			enableIntensity();
+		}
+
+		x_.insert(x_.end(), other.x_.begin(), other.x_.end());
+		y_.insert(y_.end(), other.y_.begin(), other.y_.end());
+		z_.insert(z_.end(), other.z_.begin(), other.z_.end());
+		if (other.hasColor())
+		{
+			color_.insert(color_.end(), other.color_.begin(), other.color_.end());
+		}
+		else if (hasColor())
+		{
+			color_.resize(x_.size(), Color(255, 255, 255));
+		}
+		if (other.hasIntensity())
+		{
+			intensity_.insert(intensity_.end(), other.intensity_.begin(),
+												other.intensity_.end());
+		}
+		else if (hasIntensity())
+		{
+			intensity_.resize(x_.size(), 0.0);
+		}
+	}
+
+	/**
+	 * @brief Add a color column, all current points get white color
+	 */
+	inline void enableColor()
+	{
+		if (!hasColor())
+		{
+			has_color_ = true;
+			color_.assign(x_.size(), Color(255, 255, 255));
+		}
+	}
+
+	/**
+	 * @brief Add an intensity column, all current points get zero intensity
+	 */
+	inline void enableIntensity()
+	{
+		if (!hasIntensity())
+		{
+			has_intensity_ = true;
+			intensity_.assign(x_.size(), 0.0);
+		}
+	}
+
+	inline bool hasColor() const
+	{
+		return has_color_;
+	}
+
+	inline bool hasIntensity() const
+	{
+		return has_intensity_;
+	}
+
+	/**
+	 * @brief Transform each point in the point cloud
+	 *
+	 * @param transform The transformation to be applied to each point
+	 */
+	inline void transform(const ufomap_math::Pose6& transform)
+	{
+		RigidTransform rigid(transform);
+		rigid(x_.data(), y_.data(), z_.data(), x_.data(), y_.data(), z_.data(), size());
+	}
+
+	//
+	// Columns
+	//
+
+	inline const std::vector<float>& x() const
+	{
+		return x_;
+	}
+
+	inline const std::vector<float>& y() const
+	{
+		return y_;
+	}
+
+	inline const std::vector<float>& z() const
+	{
+		return z_;
+	}
+
+	inline const std::vector<Color>& colors() const
+	{
+		return color_;
+	}
+
+	inline std::vector<Color>& colors()
+	{
+		return color_;
+	}
+
+	inline const std::vector<float>& intensities() const
+	{
+		return intensity_;
+	}
+
+	inline std::vector<float>& intensities()
+	{
+		return intensity_;
+	}
+
+private:
+	std::vector<float> x_;
+	std::vector<float> y_;
+	std::vector<float> z_;
+	std::vector<Color> color_;
+	std::vector<float> intensity_;
+	bool has_color_ = false;
+	bool has_intensity_ = false;
+};
+
+/**
+ * @brief A point cloud with a transformation that is applied when a point is read
+ *
+ * @details Used by the insertion functions taking a frame origin, so the point cloud
+ * does not have to be copied and transformed before it is inserted.
+ *
+ * @tparam CLOUD The type of the point cloud
+ */
+template <typename CLOUD>
+class TransformedPointCloud
+{
+public:
+	TransformedPointCloud(const CLOUD& cloud, const ufomap_math::Pose6& transform)
+		: cloud_(cloud), transform_(transform)
+	{
+	}
+
+	inline Point3 operator[](size_t index) const
+	{
+		return transform_(static_cast<const Point3&>(cloud_[index]));
+	}
+
+	inline size_t size() const
+	{
+		return cloud_.size();
+	}
+
+private:
+	const CLOUD& cloud_;
+	RigidTransform transform_;
+};
+}  // namespace ufomap
+
+#endif  // UFOMAP_POINT_CLOUD_SOA_H
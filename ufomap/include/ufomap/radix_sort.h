@@ -0,0 +1,90 @@
+#ifndef UFOMAP_RADIX_SORT_H
+#define UFOMAP_RADIX_SORT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ufomap
+{
+/**
+ * @brief Stable least significant digit radix sort on an unsigned integer key, 8 bits at
+ * a time
+ *
+ * @details Passes where all elements fall in the same bucket are skipped, so only the
+ * bits that differ between the elements cost anything.
+ *
+ * @param data The elements to sort
+ * @param buffer Scratch space, resized to the size of data
+ * @param num_bits The number of low bits of the keys that are sorted on
+ * @param key Function returning the uint64_t key of an element
+ */
+template <typename T, typename KEY>
+void radixSort(std::vector<T>& data, std::vector<T>& buffer, unsigned int num_bits,
+							 KEY key)
+{
+	constexpr unsigned int BITS_PER_PASS = 8;
+	constexpr size_t NUM_BUCKETS = size_t(1) << BITS_PER_PASS;
+
+	buffer.resize(data.size());
+	for (unsigned int shift = 0; shift < num_bits; shift += BITS_PER_PASS)
+	{
+		std::array<size_t, NUM_BUCKETS> offsets{};
+		for (const T& element : data)
+		{
+			++offsets[(key(element) >> shift) & (NUM_BUCKETS - 1)];
+		}
+
+		bool single_bucket = false;
+		size_t offset = 0;
+		for (size_t& count : offsets)
+		{
+			if (data.size() == count)
+			{
+				single_bucket = true;
+				break;
+			}
+			size_t bucket_size = count;
+			count = offset;
+			offset += bucket_size;
+		}
+		if (single_bucket)
+		{
+			continue;
+		}
+
+		for (T& element : data)
+		{
+			buffer[offsets[(key(element) >> shift) & (NUM_BUCKETS - 1)]++] = std::move(element);
+		}
+		data.swap(buffer);
+	}
+}
+
+/**
+ * @brief Sort and remove duplicates from a vector of unsigned integers
+ *
+ * @param values The values
+ * @param buffer Scratch space
+ * @param num_bits The number of low bits that are used by the values
+ */
+inline void radixSortUnique(std::vector<uint64_t>& values, std::vector<uint64_t>& buffer,
+														unsigned int num_bits)
+{
+	radixSort(values, buffer, num_bits, [](uint64_t value) { return value; });
+
+	size_t num_unique = 0;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		if (0 == num_unique || values[num_unique - 1] != values[i])
+		{
+			values[num_unique++] = values[i];
+		}
+	}
+	values.resize(num_unique);
+}
+}  // namespace ufomap
+
+#endif  // UFOMAP_RADIX_SORT_H
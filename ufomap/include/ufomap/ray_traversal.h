@@ -0,0 +1,332 @@
+#ifndef UFOMAP_RAY_TRAVERSAL_H
+#define UFOMAP_RAY_TRAVERSAL_H
+
+#include <immintrin.h>  // x86intrin
+#include <ufomap/key.h>
+#include <ufomap/types.h>
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ufomap
+{
+/**
+ * @brief A group of rays that are traversed voxel by voxel at the same time
+ *
+ * @details Implements the stepping part of "A Fast Voxel Traversal Algorithm for Ray
+ * Tracing" (Amanatides and Woo) for up to SIZE rays, stored as structure of arrays. With
+ * AVX2 all rays take their step at once, one ray per lane. Rays that are done are masked
+ * out until all rays in the batch are done. The voxels visited for each ray are exactly
+ * the same as when stepping the rays one at a time with OctreeBase::computeRayTakeStep.
+ *
+ */
+class RayBatch
+{
+public:
+	static constexpr size_t SIZE = 8;
+
+public:
+	RayBatch()
+	{
+	}
+
+	/**
+	 * @brief Add a ray to the batch, initialized by OctreeBase::computeRayInit
+	 *
+	 * @param current The key of the first voxel of the ray
+	 * @param ending The key of the last voxel of the ray, which is not visited
+	 * @param step The direction of each axis
+	 * @param t_delta The distance along the ray between voxel borders for each axis
+	 * @param t_max The distance along the ray to the first voxel border for each axis
+	 * @param distance The maximum distance along the ray
+	 */
+	void add(const Key& current, const Key& ending, const std::array<int, 3>& step,
+					 const Point3& t_delta, const Point3& t_max, float distance)
+	{
+		for (size_t i = 0; i < 3; ++i)
+		{
+			current_[i][size_] = current[i];
+			ending_[i][size_] = ending[i];
+			step_[i][size_] = step[i] * (1 << current.getDepth());
+			t_delta_[i][size_] = t_delta[i];
+			t_max_[i][size_] = t_max[i];
+		}
+		distance_[size_] = distance;
+		depth_ = current.getDepth();
+		++size_;
+	}
+
+	/**
+	 * @brief Add a ray that does not visit any voxels
+	 *
+	 */
+	void addEmpty(const Key& key)
+	{
+		for (size_t i = 0; i < 3; ++i)
+		{
+			current_[i][size_] = key[i];
+			ending_[i][size_] = key[i];
+			step_[i][size_] = 0;
+			t_delta_[i][size_] = 0;
+			t_max_[i][size_] = 0;
+		}
+		distance_[size_] = 0;
+		++size_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	bool empty() const
+	{
+		return 0 == size_;
+	}
+
+	bool full() const
+	{
+		return SIZE == size_;
+	}
+
+	void clear()
+	{
+		size_ = 0;
+	}
+
+	/**
+	 * @brief Step all rays to their end, calling fn(ray_index, key) for each visited voxel
+	 *
+	 * @remark All rays in the batch have to be at the same depth
+	 *
+	 * @param fn Function that is called with the index of the ray in the batch and the key
+	 * of the voxel
+	 */
+	template <typename FN>
+	void traverse(FN&& fn)
+	{
+#if defined(__AVX2__)
+		if (1 < size_)
+		{
+			traverseAVX2(fn);
+			return;
+		}
+#endif
+		traverseScalar(fn);
+	}
+
+protected:
+	template <typename FN>
+	void traverseScalar(FN&& fn)
+	{
+		for (size_t i = 0; i < size_; ++i)
+		{
+			Key current(current_[0][i], current_[1][i], current_[2][i], depth_);
+			Point3 t_max(t_max_[0][i], t_max_[1][i], t_max_[2][i]);
+			while ((current[0] != ending_[0][i] || current[1] != ending_[1][i] ||
+							current[2] != ending_[2][i]) &&
+						 t_max.min() <= distance_[i])
+			{
+				fn(i, current);
+				size_t advance_dim = t_max.minElementIndex();
+				current[advance_dim] += step_[advance_dim][i];
+				t_max[advance_dim] += t_delta_[advance_dim][i];
+			}
+		}
+	}
+
+#if defined(__AVX2__)
+	template <typename FN>
+	void traverseAVX2(FN&& fn)
+	{
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(size_), lanes);
+
+		__m256i cx = _mm256_load_si256(reinterpret_cast<const __m256i*>(current_[0].data()));
+		__m256i cy = _mm256_load_si256(reinterpret_cast<const __m256i*>(current_[1].data()));
+		__m256i cz = _mm256_load_si256(reinterpret_cast<const __m256i*>(current_[2].data()));
+		const __m256i ex =
+				_mm256_load_si256(reinterpret_cast<const __m256i*>(ending_[0].data()));
+		const __m256i ey =
+				_mm256_load_si256(reinterpret_cast<const __m256i*>(ending_[1].data()));
+		const __m256i ez =
+				_mm256_load_si256(reinterpret_cast<const __m256i*>(ending_[2].data()));
+		const __m256i sx = _mm256_load_si256(reinterpret_cast<const __m256i*>(step_[0].data()));
+		const __m256i sy = _mm256_load_si256(reinterpret_cast<const __m256i*>(step_[1].data()));
+		const __m256i sz = _mm256_load_si256(reinterpret_cast<const __m256i*>(step_[2].data()));
+		const __m256 dx = _mm256_load_ps(t_delta_[0].data());
+		const __m256 dy = _mm256_load_ps(t_delta_[1].data());
+		const __m256 dz = _mm256_load_ps(t_delta_[2].data());
+		__m256 tx = _mm256_load_ps(t_max_[0].data());
+		__m256 ty = _mm256_load_ps(t_max_[1].data());
+		__m256 tz = _mm256_load_ps(t_max_[2].data());
+		const __m256 dist = _mm256_load_ps(distance_.data());
+
+		alignas(32) std::array<KeyType, SIZE> out_x;
+		alignas(32) std::array<KeyType, SIZE> out_y;
+		alignas(32) std::array<KeyType, SIZE> out_z;
+
+		while (true)
+		{
+			// current != ending && t_max.min() <= distance
+			__m256i at_end = _mm256_and_si256(
+					_mm256_and_si256(_mm256_cmpeq_epi32(cx, ex), _mm256_cmpeq_epi32(cy, ey)),
+					_mm256_cmpeq_epi32(cz, ez));
+			__m256 t_min = _mm256_min_ps(_mm256_min_ps(tx, ty), tz);
+			__m256i in_range = _mm256_castps_si256(_mm256_cmp_ps(t_min, dist, _CMP_LE_OQ));
+			valid = _mm256_andnot_si256(at_end, _mm256_and_si256(valid, in_range));
+
+			int active = _mm256_movemask_ps(_mm256_castsi256_ps(valid));
+			if (0 == active)
+			{
+				break;
+			}
+
+			// Visit
+			_mm256_store_si256(reinterpret_cast<__m256i*>(out_x.data()), cx);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(out_y.data()), cy);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(out_z.data()), cz);
+			for (int bits = active; 0 != bits; bits &= bits - 1)
+			{
+				int i = __builtin_ctz(bits);
+				fn(static_cast<size_t>(i), Key(out_x[i], out_y[i], out_z[i], depth_));
+			}
+
+			// Same tie breaking as Point3::minElementIndex
+			__m256 x_le_y = _mm256_cmp_ps(tx, ty, _CMP_LE_OQ);
+			__m256 mx = _mm256_and_ps(x_le_y, _mm256_cmp_ps(tx, tz, _CMP_LE_OQ));
+			__m256 my = _mm256_andnot_ps(x_le_y, _mm256_cmp_ps(ty, tz, _CMP_LE_OQ));
+			__m256 mz = _mm256_andnot_ps(_mm256_or_ps(mx, my), _mm256_castsi256_ps(valid));
+			mx = _mm256_and_ps(mx, _mm256_castsi256_ps(valid));
+			my = _mm256_and_ps(my, _mm256_castsi256_ps(valid));
+
+			cx = _mm256_add_epi32(cx, _mm256_and_si256(sx, _mm256_castps_si256(mx)));
+			cy = _mm256_add_epi32(cy, _mm256_and_si256(sy, _mm256_castps_si256(my)));
+			cz = _mm256_add_epi32(cz, _mm256_and_si256(sz, _mm256_castps_si256(mz)));
+			tx = _mm256_blendv_ps(tx, _mm256_add_ps(tx, dx), mx);
+			ty = _mm256_blendv_ps(ty, _mm256_add_ps(ty, dy), my);
+			tz = _mm256_blendv_ps(tz, _mm256_add_ps(tz, dz), mz);
+		}
+	}
+#endif
+
+protected:
+	alignas(32) std::array<KeyType, SIZE> current_[3];
+	alignas(32) std::array<KeyType, SIZE> ending_[3];
+	alignas(32) std::array<int, SIZE> step_[3];
+	alignas(32) std::array<float, SIZE> t_delta_[3];
+	alignas(32) std::array<float, SIZE> t_max_[3];
+	alignas(32) std::array<float, SIZE> distance_;
+	unsigned int depth_ = 0;
+	size_t size_ = 0;
+};
+
+/**
+ * @brief Dense set of the depth 0 voxels closest to the sensor origin.
+ *
+ * @details All rays of a point cloud start at the sensor origin, so close to it the same
+ * voxels are visited by thousands of rays. Checking a bit here is much cheaper than a
+ * lookup in the hash map of updates, and only the first visit of each voxel has to go to
+ * the hash map. Voxels outside of the grid are always reported as new. A grid is meant
+ * to be kept and reset for each point cloud, so it is only allocated once.
+ *
+ * This does not prune the rays. Every ray is still stepped through all of its voxels,
+ * only the repeated hash map inserts are skipped. A ray cannot stop where earlier rays
+ * have already been, since the voxels after that are not known to be free unless the
+ * ray is traced.
+ */
+class VisitedGrid
+{
+public:
+	// Number of voxels along each axis
+	static constexpr KeyType SIZE = 64;
+
+public:
+	VisitedGrid() : visited_(std::make_unique<std::bitset<SIZE * SIZE * SIZE>>())
+	{
+	}
+
+	VisitedGrid(const VisitedGrid& other)
+		: min_(other.min_)
+		, visited_(std::make_unique<std::bitset<SIZE * SIZE * SIZE>>(*other.visited_))
+		, set_(other.set_)
+	{
+	}
+
+	VisitedGrid(VisitedGrid&& other) = default;
+
+	VisitedGrid& operator=(const VisitedGrid& rhs)
+	{
+		min_ = rhs.min_;
+		*visited_ = *rhs.visited_;
+		set_ = rhs.set_;
+		return *this;
+	}
+
+	VisitedGrid& operator=(VisitedGrid&& rhs) = default;
+
+	/**
+	 * @brief Center the grid on a voxel and forget all visited voxels
+	 *
+	 * @param center The key of the voxel, has to be at depth 0
+	 */
+	void reset(const Key& center)
+	{
+		min_ = { center[0] - (SIZE / 2), center[1] - (SIZE / 2), center[2] - (SIZE / 2) };
+
+		if (visited_->size() / 64 < set_.size())
+		{
+			// Cheaper to clear all of it
+			visited_->reset();
+		}
+		else
+		{
+			for (uint32_t index : set_)
+			{
+				visited_->reset(index);
+			}
+		}
+		set_.clear();
+	}
+
+	/**
+	 * @brief Mark a voxel as visited
+	 *
+	 * @param key The key of the voxel, has to be at depth 0
+	 * @return true If the voxel had not been visited before or is outside of the grid
+	 * @return false If the voxel has already been visited
+	 */
+	bool insert(const Key& key)
+	{
+		// Wraps around for keys below min_
+		KeyType x = key[0] - min_[0];
+		KeyType y = key[1] - min_[1];
+		KeyType z = key[2] - min_[2];
+		if (SIZE <= x || SIZE <= y || SIZE <= z)
+		{
+			return true;
+		}
+
+		uint32_t index = (((z * SIZE) + y) * SIZE) + x;
+		if ((*visited_)[index])
+		{
+			return false;
+		}
+		visited_->set(index);
+		set_.push_back(index);
+		return true;
+	}
+
+protected:
+	std::array<KeyType, 3> min_{};
+	std::unique_ptr<std::bitset<SIZE * SIZE * SIZE>> visited_;
+	// The indices of the set bits, so reset only has to clear those
+	std::vector<uint32_t> set_;
+};
+}  // namespace ufomap
+
+#endif  // UFOMAP_RAY_TRAVERSAL_H
@@ -2,8 +2,10 @@
 #define UFOMAP_UFOMAP_H
 
 #include <ufomap/octree.h>
+#include <ufomap/octree_quantized.h>
 #include <ufomap/octree_rgb.h>
 #include <ufomap/point_cloud.h>
 #include <ufomap/types.h>
+#include <ufomap/voxel_hash_map.h>
 
 #endif  // UFOMAP_UFOMAP_H
\ No newline at end of file
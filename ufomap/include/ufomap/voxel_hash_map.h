@@ -0,0 +1,937 @@
+#ifndef UFOMAP_VOXEL_HASH_MAP_H
+#define UFOMAP_VOXEL_HASH_MAP_H
+
+#include <ufomap/code.h>
+#include <ufomap/key.h>
+#include <ufomap/node.h>
+#include <ufomap/point_cloud.h>
+#include <ufomap/point_cloud_soa.h>
+#include <ufomap/radix_sort.h>
+#include <ufomap/ray_traversal.h>
+#include <ufomap/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace ufomap
+{
+/**
+ * @brief An occupancy map stored as a spatial hash of dense voxel blocks
+ *
+ * @details The voxels are stored in blocks of 8x8x8, found by the code of the block in a
+ * hash map, so a voxel is accessed in constant time without descending a tree. Same
+ * insertion, query and iteration interface as the octrees at depth 0, and a scan
+ * inserted here gives the same voxels as OctreeBase::insertPointCloud. Meant for small,
+ * often updated regions. There is no pruning, all observed voxels take memory.
+ *
+ * Use toOctree and fromOctree to save, load or do coarse queries.
+ *
+ * Not supported, use an octree for these: insertPointCloudDiscrete with n or depth
+ * larger than 0, insertPointCloudAdaptive, point clouds with one sensor origin per point
+ * or with timestamps, insert sessions, insertDepthImage, insertRangeImage, the bounding
+ * box limit, change detection, concurrency and multi-threaded ray tracing.
+ */
+class VoxelHashMap
+{
+public:
+	// The blocks hold the voxels of a node at this depth
+	static constexpr unsigned int BLOCK_DEPTH = 3;
+	static constexpr size_t BLOCK_SIZE = size_t(1) << (3 * BLOCK_DEPTH);
+
+	// The voxels of a block, indexed by the lowest 3 * BLOCK_DEPTH bits of their codes
+	using Block = std::array<OccupancyNode, BLOCK_SIZE>;
+
+	/**
+	 * @brief Iterates over the voxels of a VoxelHashMap block by block, with the same
+	 * accessors as the octree iterators
+	 */
+	class LeafIterator
+	{
+	public:
+		// iterator traits
+		using difference_type = std::ptrdiff_t;
+		using value_type = Node<OccupancyNode>;
+		using pointer = const Node<OccupancyNode>*;
+		using reference = const Node<OccupancyNode>&;
+		using iterator_category = std::forward_iterator_tag;
+
+	public:
+		LeafIterator()
+		{
+		}
+
+		LeafIterator(const VoxelHashMap* map, bool occupied_space, bool free_space,
+								 bool unknown_space)
+			: map_(map)
+			, occupied_space_(occupied_space)
+			, free_space_(free_space)
+			, unknown_space_(unknown_space)
+		{
+			if (map_->blocks_.empty())
+			{
+				map_ = nullptr;
+				return;
+			}
+			setNode();
+			if (!validNode())
+			{
+				operator++();
+			}
+		}
+
+		bool operator==(const LeafIterator& rhs) const
+		{
+			return rhs.map_ == map_ &&
+						 (nullptr == map_ || (rhs.block_ == block_ && rhs.voxel_ == voxel_));
+		}
+
+		bool operator!=(const LeafIterator& rhs) const
+		{
+			return !(*this == rhs);
+		}
+
+		// Postfix increment
+		LeafIterator operator++(int)
+		{
+			LeafIterator result = *this;
+			++(*this);
+			return result;
+		}
+
+		// Prefix increment
+		LeafIterator& operator++()
+		{
+			do
+			{
+				if (BLOCK_SIZE == ++voxel_)
+				{
+					voxel_ = 0;
+					if (map_->blocks_.size() == ++block_)
+					{
+						map_ = nullptr;
+						return *this;
+					}
+				}
+				setNode();
+			} while (!validNode());
+			return *this;
+		}
+
+		const Node<OccupancyNode>* operator->() const
+		{
+			return &node_;
+		}
+
+		const Node<OccupancyNode>& operator*() const
+		{
+			return node_;
+		}
+
+		bool isOccupied() const
+		{
+			return map_->isOccupied(node_);
+		}
+
+		bool isFree() const
+		{
+			return map_->isFree(node_);
+		}
+
+		bool isUnknown() const
+		{
+			return map_->isUnknown(node_);
+		}
+
+		float getProbability() const
+		{
+			return map_->probability(node_);
+		}
+
+		float getLogit() const
+		{
+			return map_->logit(node_);
+		}
+
+		float getSize() const
+		{
+			return map_->getResolution();
+		}
+
+		float getHalfSize() const
+		{
+			return map_->getNodeHalfSize(0);
+		}
+
+		unsigned int getDepth() const
+		{
+			return 0;
+		}
+
+		Point3 getCenter() const
+		{
+			return map_->keyToCoord(node_.code.toKey());
+		}
+
+		float getX() const
+		{
+			return map_->keyToCoord(node_.code.toKey(0));
+		}
+
+		float getY() const
+		{
+			return map_->keyToCoord(node_.code.toKey(1));
+		}
+
+		float getZ() const
+		{
+			return map_->keyToCoord(node_.code.toKey(2));
+		}
+
+		bool isPureLeaf() const
+		{
+			return true;
+		}
+
+		bool isLeaf() const
+		{
+			return true;
+		}
+
+	protected:
+		void setNode()
+		{
+			node_.node = &map_->blocks_[block_][voxel_];
+			node_.code = Code(map_->block_codes_[block_].getCode() | voxel_, 0);
+		}
+
+		bool validNode() const
+		{
+			return (occupied_space_ && isOccupied()) || (free_space_ && isFree()) ||
+						 (unknown_space_ && isUnknown());
+		}
+
+	protected:
+		const VoxelHashMap* map_ = nullptr;
+		size_t block_ = 0;
+		size_t voxel_ = 0;
+		Node<OccupancyNode> node_;
+
+		bool occupied_space_ = true;
+		bool free_space_ = true;
+		bool unknown_space_ = false;
+	};
+
+	using leaf_iterator = LeafIterator;
+
+public:
+	VoxelHashMap(float resolution = 0.1, unsigned int depth_levels = 16,
+							 float occupancy_thres = 0.5, float free_thres = 0.5, float prob_hit = 0.7,
+							 float prob_miss = 0.4, float clamping_thres_min = 0.1192,
+							 float clamping_thres_max = 0.971)
+		: occupancy_thres_log_(logit(occupancy_thres))
+		, free_thres_log_(logit(free_thres))
+		, prob_hit_log_(logit(prob_hit))
+		, prob_miss_log_(logit(prob_miss))
+		, clamping_thres_min_log_(logit(clamping_thres_min))
+		, clamping_thres_max_log_(logit(clamping_thres_max))
+	{
+		clear(resolution, depth_levels);
+		indices_.max_load_factor(0.8);
+		indices_.reserve(100003);
+	}
+
+	//
+	// Insertion
+	//
+
+	/**
+	 * @brief Insert a point cloud, same as OctreeBase::insertPointCloud
+	 *
+	 * @remark Rays with the sensor origin or the point outside of the map are skipped
+	 */
+	void insertPointCloud(const Point3& sensor_origin, const PointCloud& cloud,
+												float max_range = -1)
+	{
+		insertPointCloudImpl(sensor_origin, cloud, max_range);
+	}
+
+	void insertPointCloud(const Point3& sensor_origin, const PointCloudSoA& cloud,
+												float max_range = -1)
+	{
+		insertPointCloudImpl(sensor_origin, cloud, max_range);
+	}
+
+	void insertPointCloud(const Point3& sensor_origin, const PointCloud& cloud,
+												const ufomap_math::Pose6& frame_origin, float max_range = -1)
+	{
+		insertPointCloudImpl(sensor_origin, TransformedPointCloud(cloud, frame_origin),
+												 max_range);
+	}
+
+	void insertPointCloud(const Point3& sensor_origin, const PointCloudSoA& cloud,
+												const ufomap_math::Pose6& frame_origin, float max_range = -1)
+	{
+		insertPointCloudImpl(sensor_origin, TransformedPointCloud(cloud, frame_origin),
+												 max_range);
+	}
+
+	/**
+	 * @brief Insert a point cloud with one ray to the center of each voxel with points,
+	 * same as OctreeBase::insertPointCloudDiscrete with n and depth 0
+	 *
+	 * @remark There are no coarser nodes to update, so n and depth have to be 0
+	 */
+	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloud& cloud,
+																float max_range = -1, unsigned int n = 0,
+																unsigned int depth = 0)
+	{
+		insertPointCloudDiscreteImpl(sensor_origin, cloud, max_range, n, depth);
+	}
+
+	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloudSoA& cloud,
+																float max_range = -1, unsigned int n = 0,
+																unsigned int depth = 0)
+	{
+		insertPointCloudDiscreteImpl(sensor_origin, cloud, max_range, n, depth);
+	}
+
+	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloud& cloud,
+																const ufomap_math::Pose6& frame_origin,
+																float max_range = -1, unsigned int n = 0,
+																unsigned int depth = 0)
+	{
+		insertPointCloudDiscreteImpl(
+				sensor_origin, TransformedPointCloud(cloud, frame_origin), max_range, n, depth);
+	}
+
+	void insertPointCloudDiscrete(const Point3& sensor_origin, const PointCloudSoA& cloud,
+																const ufomap_math::Pose6& frame_origin,
+																float max_range = -1, unsigned int n = 0,
+																unsigned int depth = 0)
+	{
+		insertPointCloudDiscreteImpl(
+				sensor_origin, TransformedPointCloud(cloud, frame_origin), max_range, n, depth);
+	}
+
+	Node<OccupancyNode> integrateHit(const Key& key)
+	{
+		return updateNodeValue(key, prob_hit_log_);
+	}
+
+	Node<OccupancyNode> integrateHit(const Point3& coord)
+	{
+		return integrateHit(coordToKey(coord));
+	}
+
+	Node<OccupancyNode> integrateMiss(const Key& key)
+	{
+		return updateNodeValue(key, prob_miss_log_);
+	}
+
+	Node<OccupancyNode> integrateMiss(const Point3& coord)
+	{
+		return integrateMiss(coordToKey(coord));
+	}
+
+	Node<OccupancyNode> updateNodeValue(const Key& key, float logit_update)
+	{
+		Code code(key);
+		OccupancyNode& voxel = getVoxel(code);
+		voxel.logit = std::clamp(voxel.logit + logit_update, clamping_thres_min_log_,
+														 clamping_thres_max_log_);
+		return Node<OccupancyNode>(&voxel, code);
+	}
+
+	Node<OccupancyNode> setNodeValue(const Key& key, float logit_value)
+	{
+		Code code(key);
+		OccupancyNode& voxel = getVoxel(code);
+		voxel.logit =
+				std::clamp(logit_value, clamping_thres_min_log_, clamping_thres_max_log_);
+		return Node<OccupancyNode>(&voxel, code);
+	}
+
+	Node<OccupancyNode> setNodeValue(const Point3& coord, float logit_value)
+	{
+		return setNodeValue(coordToKey(coord), logit_value);
+	}
+
+	//
+	// Get node
+	//
+
+	/**
+	 * @brief Get the voxel with code, voxels that have never been set are unknown
+	 *
+	 * @param code The code of the voxel, has to be at depth 0
+	 */
+	Node<OccupancyNode> getNode(const Code& code) const
+	{
+		auto it = block_indices_.find(code.toDepth(BLOCK_DEPTH));
+		if (block_indices_.end() == it)
+		{
+			return Node<OccupancyNode>(&unknown_, code);
+		}
+		return Node<OccupancyNode>(&blocks_[it->second][voxelIndex(code)], code);
+	}
+
+	Node<OccupancyNode> getNode(const Key& key) const
+	{
+		return getNode(Code(key));
+	}
+
+	Node<OccupancyNode> getNode(const Point3& coord) const
+	{
+		return getNode(coordToKey(coord));
+	}
+
+	Node<OccupancyNode> getNode(float x, float y, float z) const
+	{
+		return getNode(coordToKey(x, y, z));
+	}
+
+	//
+	// Checking state of node
+	//
+
+	bool isOccupied(const Node<OccupancyNode>& node) const
+	{
+		return isOccupiedLog(node.node->logit);
+	}
+
+	bool isOccupied(const Code& code) const
+	{
+		return isOccupied(getNode(code));
+	}
+
+	bool isOccupied(const Key& key) const
+	{
+		return isOccupied(getNode(key));
+	}
+
+	bool isOccupied(const Point3& coord) const
+	{
+		return isOccupied(getNode(coord));
+	}
+
+	bool isOccupied(float x, float y, float z) const
+	{
+		return isOccupied(getNode(x, y, z));
+	}
+
+	bool isOccupiedLog(float logit) const
+	{
+		return occupancy_thres_log_ < logit;
+	}
+
+	bool isFree(const Node<OccupancyNode>& node) const
+	{
+		return isFreeLog(node.node->logit);
+	}
+
+	bool isFree(const Code& code) const
+	{
+		return isFree(getNode(code));
+	}
+
+	bool isFree(const Key& key) const
+	{
+		return isFree(getNode(key));
+	}
+
+	bool isFree(const Point3& coord) const
+	{
+		return isFree(getNode(coord));
+	}
+
+	bool isFree(float x, float y, float z) const
+	{
+		return isFree(getNode(x, y, z));
+	}
+
+	bool isFreeLog(float logit) const
+	{
+		return free_thres_log_ > logit;
+	}
+
+	bool isUnknown(const Node<OccupancyNode>& node) const
+	{
+		return isUnknownLog(node.node->logit);
+	}
+
+	bool isUnknown(const Code& code) const
+	{
+		return isUnknown(getNode(code));
+	}
+
+	bool isUnknown(const Key& key) const
+	{
+		return isUnknown(getNode(key));
+	}
+
+	bool isUnknown(const Point3& coord) const
+	{
+		return isUnknown(getNode(coord));
+	}
+
+	bool isUnknown(float x, float y, float z) const
+	{
+		return isUnknown(getNode(x, y, z));
+	}
+
+	bool isUnknownLog(float logit) const
+	{
+		return free_thres_log_ <= logit && occupancy_thres_log_ >= logit;
+	}
+
+	//
+	// Probability
+	//
+
+	float logit(const Node<OccupancyNode>& node) const
+	{
+		return node.node->logit;
+	}
+
+	float logit(float probability) const
+	{
+		return std::log(probability / (1.0 - probability));
+	}
+
+	float probability(const Node<OccupancyNode>& node) const
+	{
+		return probability(node.node->logit);
+	}
+
+	float probability(float logit) const
+	{
+		return 1.0 - (1.0 / (1.0 + std::exp(logit)));
+	}
+
+	//
+	// Iterators
+	//
+
+	/**
+	 * @brief Iterate over the voxels, block by block
+	 *
+	 * @remark Only the unknown voxels in blocks that hold observed voxels are visited
+	 */
+	leaf_iterator begin_leafs(bool occupied_space = true, bool free_space = true,
+														bool unknown_space = false) const
+	{
+		return leaf_iterator(this, occupied_space, free_space, unknown_space);
+	}
+
+	const leaf_iterator end_leafs() const
+	{
+		return leaf_iterator();
+	}
+
+	//
+	// Conversion
+	//
+
+	/**
+	 * @brief Replace the content of octree with the voxels of this map.
+	 *
+	 * @details The octree gets the resolution and depth levels of this map and is pruned as
+	 * usual, so it can be written to file or queried at coarser depths.
+	 *
+	 * @param octree An octree storing logits, e.g. Octree or OctreeQ16
+	 */
+	template <typename TREE>
+	void toOctree(TREE& octree) const
+	{
+		octree.clear(resolution_, depth_levels_);
+		for (size_t i = 0; i < blocks_.size(); ++i)
+		{
+			uint64_t block_code = block_codes_[i].getCode();
+			for (size_t j = 0; j < BLOCK_SIZE; ++j)
+			{
+				if (0 != blocks_[i][j].logit)
+				{
+					octree.setNodeValue(Code(block_code | j, 0), blocks_[i][j].logit);
+				}
+			}
+		}
+	}
+
+	/**
+	 * @brief Replace the content of this map with the known space of octree.
+	 *
+	 * @details The map gets the resolution and depth levels of octree. Nodes above depth
+	 * 0 are split into all their voxels, so a large free node takes a lot of memory here.
+	 *
+	 * @param octree An octree storing logits, e.g. Octree or OctreeQ16
+	 */
+	template <typename TREE>
+	void fromOctree(const TREE& octree)
+	{
+		clear(octree.getResolution(), octree.getTreeDepthLevels());
+		for (auto it = octree.begin_leafs(true, true, false), end = octree.end_leafs();
+				 it != end; ++it)
+		{
+			float logit = it->node->logit;
+			uint64_t first = it->code.getCode();
+			uint64_t last = first + (uint64_t(1) << (3 * it->getDepth()));
+			for (uint64_t code = first; code < last; ++code)
+			{
+				getVoxel(Code(code, 0)).logit = logit;
+			}
+		}
+	}
+
+	//
+	// Clear
+	//
+
+	void clear()
+	{
+		blocks_.clear();
+		block_codes_.clear();
+		block_indices_.clear();
+	}
+
+	void clear(float resolution, unsigned int depth_levels)
+	{
+		if (21 < depth_levels || BLOCK_DEPTH >= depth_levels)
+		{
+			throw std::invalid_argument("depth_levels has to be between 4 and 21");
+		}
+
+		clear();
+		resolution_ = resolution;
+		resolution_factor_ = 1.0 / resolution;
+		depth_levels_ = depth_levels;
+		max_value_ = std::pow(2, depth_levels - 1);
+	}
+
+	//
+	// Information
+	//
+
+	float getResolution() const
+	{
+		return resolution_;
+	}
+
+	unsigned int getTreeDepthLevels() const
+	{
+		return depth_levels_;
+	}
+
+	float getNodeSize(unsigned int depth) const
+	{
+		return resolution_ * float(uint64_t(1) << depth);
+	}
+
+	float getNodeHalfSize(unsigned int depth) const
+	{
+		return getNodeSize(depth) / 2.0;
+	}
+
+	/**
+	 * @return The minimum point the map can store
+	 */
+	Point3 getMin() const
+	{
+		float half_size = -getNodeSize(depth_levels_ - 1);
+		return Point3(half_size, half_size, half_size);
+	}
+
+	/**
+	 * @return The maximum point the map can store
+	 */
+	Point3 getMax() const
+	{
+		float half_size = getNodeSize(depth_levels_ - 1);
+		return Point3(half_size, half_size, half_size);
+	}
+
+	/**
+	 * @return size_t Number of voxels in the blocks, including the unknown ones
+	 */
+	size_t size() const
+	{
+		return blocks_.size() * BLOCK_SIZE;
+	}
+
+	size_t numBlocks() const
+	{
+		return blocks_.size();
+	}
+
+	/**
+	 * @return size_t Memory usage of the blocks and the hash map
+	 */
+	size_t memoryUsage() const
+	{
+		return (blocks_.size() * (sizeof(Block) + sizeof(Code))) +
+					 (block_indices_.bucket_count() * sizeof(std::pair<Code, size_t>));
+	}
+
+	//
+	// Coordinate and key conversion
+	//
+
+	inline unsigned int coordToKey(float coord) const
+	{
+		return (int)floor(resolution_factor_ * coord) + max_value_;
+	}
+
+	inline Key coordToKey(const Point3& coord) const
+	{
+		return Key(coordToKey(coord[0]), coordToKey(coord[1]), coordToKey(coord[2]), 0);
+	}
+
+	inline Key coordToKey(float x, float y, float z) const
+	{
+		return Key(coordToKey(x), coordToKey(y), coordToKey(z), 0);
+	}
+
+	inline float keyToCoord(KeyType key, unsigned int depth = 0) const
+	{
+		float divider = float(1 << depth);
+		return (floor((double(key) - double(max_value_)) / divider) + 0.5) *
+					 getNodeSize(depth);
+	}
+
+	inline Point3 keyToCoord(const Key& key) const
+	{
+		return Point3(keyToCoord(key[0], key.getDepth()), keyToCoord(key[1], key.getDepth()),
+									keyToCoord(key[2], key.getDepth()));
+	}
+
+protected:
+	static size_t voxelIndex(const Code& code)
+	{
+		return code.getCode() & (BLOCK_SIZE - 1);
+	}
+
+	/**
+	 * @brief Get the voxel with code, the block is created if it does not exist
+	 */
+	OccupancyNode& getVoxel(const Code& code)
+	{
+		Code block_code = code.toDepth(BLOCK_DEPTH);
+		auto [it, inserted] = block_indices_.try_emplace(block_code, blocks_.size());
+		if (inserted)
+		{
+			blocks_.emplace_back();
+			block_codes_.push_back(block_code);
+		}
+		return blocks_[it->second][voxelIndex(code)];
+	}
+
+	bool inMap(const Point3& coord) const
+	{
+		Point3 min = getMin();
+		Point3 max = getMax();
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			if (min[i] > coord[i] || max[i] <= coord[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <typename CLOUD>
+	void insertPointCloudImpl(const Point3& sensor_origin, const CLOUD& cloud,
+														float max_range,
+														size_t num_hits = std::numeric_limits<size_t>::max())
+	{
+		computeUpdate(sensor_origin, cloud, max_range, num_hits);
+
+		for (const auto& [code, value] : indices_)
+		{
+			OccupancyNode& voxel = getVoxel(code);
+			voxel.logit = std::clamp(voxel.logit + value, clamping_thres_min_log_,
+															 clamping_thres_max_log_);
+		}
+		indices_.clear();
+	}
+
+	template <typename CLOUD>
+	void insertPointCloudDiscreteImpl(const Point3& sensor_origin, const CLOUD& cloud,
+																		float max_range, unsigned int n, unsigned int depth)
+	{
+		if (0 != n || 0 != depth)
+		{
+			throw std::invalid_argument(
+					"VoxelHashMap only supports insertPointCloudDiscrete with n and depth 0");
+		}
+
+		// The unique voxels of the points, in Morton order as in the octree
+		discrete_codes_.clear();
+		for (size_t i = 0; i < cloud.size(); ++i)
+		{
+			discrete_codes_.push_back(Code(coordToKey(cloud[i])).getCode());
+		}
+		radixSortUnique(discrete_codes_, discrete_buffer_, 64);
+
+		// Rays to the centers of the voxels give hits. As in the octree, a ray longer than
+		// max_range goes to the center of the voxel where it is cut, without a hit.
+		discrete_cloud_.clear();
+		discrete_miss_codes_.clear();
+		for (uint64_t code : discrete_codes_)
+		{
+			Point3 center = keyToCoord(Code(code, 0).toKey());
+			if (0 <= max_range)
+			{
+				Point3 end = center - sensor_origin;
+				float distance = end.norm();
+				Point3 dir = end / distance;
+				if (distance > max_range)
+				{
+					end = sensor_origin + (dir * max_range);
+					discrete_miss_codes_.push_back(Code(coordToKey(end)).getCode());
+					continue;
+				}
+			}
+			discrete_cloud_.push_back(center);
+		}
+		size_t num_hits = discrete_cloud_.size();
+
+		radixSortUnique(discrete_miss_codes_, discrete_buffer_, 64);
+		for (uint64_t code : discrete_miss_codes_)
+		{
+			discrete_cloud_.push_back(keyToCoord(Code(code, 0).toKey()));
+		}
+
+		insertPointCloudImpl(sensor_origin, discrete_cloud_, -1, num_hits);
+	}
+
+	/**
+	 * @brief Trace the rays of cloud into indices_, the same way as
+	 * OctreeBase::computeUpdate. A hit overrides a miss.
+	 *
+	 * @param num_hits Only the first num_hits points give hits, the rest only free space
+	 */
+	template <typename CLOUD>
+	void computeUpdate(const Point3& sensor_origin, const CLOUD& cloud, float max_range,
+										 size_t num_hits)
+	{
+		if (!inMap(sensor_origin))
+		{
+			return;
+		}
+
+		// The misses are traversed RayBatch::SIZE rays at a time
+		RayBatch rays;
+		// Voxels close to the sensor are only added to indices the first time
+		visited_.reset(coordToKey(sensor_origin));
+		auto add_miss = [this](size_t, const Key& key) {
+			if (visited_.insert(key))
+			{
+				indices_.try_emplace(key, prob_miss_log_);
+			}
+		};
+
+		for (size_t i = 0; i < cloud.size(); ++i)
+		{
+			Point3 point = cloud[i];
+			Point3 end = point - sensor_origin;
+			float distance = end.norm();
+			Point3 dir = end / distance;
+			if (0 <= max_range && distance > max_range)
+			{
+				end = sensor_origin + (dir * max_range);
+			}
+			else
+			{
+				end = point;
+			}
+
+			if (!inMap(end))
+			{
+				continue;
+			}
+
+			if (point == end && i < num_hits)
+			{
+				indices_[Code(coordToKey(end))] = prob_hit_log_;
+			}
+
+			Key current = coordToKey(sensor_origin);
+			Key ending = coordToKey(end);
+			if (current == ending)
+			{
+				continue;
+			}
+
+			std::array<int, 3> step;
+			Point3 t_delta;
+			Point3 t_max;
+			Point3 voxel_border = keyToCoord(current);
+			for (unsigned int j = 0; j < 3; ++j)
+			{
+				step[j] = 0 < dir[j] ? 1 : (0 > dir[j] ? -1 : 0);
+				if (0 != step[j])
+				{
+					t_delta[j] = resolution_ / std::fabs(dir[j]);
+					voxel_border[j] += (float)(step[j] * (resolution_ / 2.0));
+					t_max[j] = (voxel_border[j] - sensor_origin[j]) / dir[j];
+				}
+				else
+				{
+					t_delta[j] = std::numeric_limits<float>::max();
+					t_max[j] = std::numeric_limits<float>::max();
+				}
+			}
+
+			rays.add(current, ending, step, t_delta, t_max, distance);
+			if (rays.full())
+			{
+				rays.traverse(add_miss);
+				rays.clear();
+			}
+		}
+
+		// Increment the rays that are left
+		rays.traverse(add_miss);
+	}
+
+protected:
+	float resolution_;
+	float resolution_factor_;
+	unsigned int depth_levels_;
+	unsigned int max_value_;
+
+	float occupancy_thres_log_;
+	float free_thres_log_;
+	float prob_hit_log_;
+	float prob_miss_log_;
+	float clamping_thres_min_log_;
+	float clamping_thres_max_log_;
+
+	// Never moved, so nodes returned by getNode stay valid when blocks are added
+	std::deque<Block> blocks_;
+	std::vector<Code> block_codes_;
+	CodeMap<size_t> block_indices_;
+
+	// Returned for voxels in blocks that do not exist
+	OccupancyNode unknown_;
+
+	CodeMap<float> indices_;
+	VisitedGrid visited_;  // Near-sensor voxels traced into indices_
+
+	// Used in insertPointCloudDiscrete
+	std::vector<uint64_t> discrete_codes_;
+	std::vector<uint64_t> discrete_miss_codes_;
+	std::vector<uint64_t> discrete_buffer_;
+	PointCloud discrete_cloud_;
+};
+}  // namespace ufomap
+
+#endif  // UFOMAP_VOXEL_HASH_MAP_H
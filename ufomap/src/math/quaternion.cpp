@@ -252,6 +252,35 @@ Vector3 Quaternion::rotate(const Vector3& v) const
 	return Vector3(q.x(), q.y(), q.z());
 }
 
+Quaternion Quaternion::slerp(const Quaternion& other, float t) const
+{
+	float cos_theta = w() * other.w() + x() * other.x() + y() * other.y() + z() * other.z();
+	// q and -q are the same rotation, take the shortest path
+	float sign = 0 > cos_theta ? -1.0 : 1.0;
+	cos_theta *= sign;
+
+	float s_this;
+	float s_other;
+	if (0.9995 < cos_theta)
+	{
+		// Almost the same rotation, linear interpolation is accurate and stable
+		s_this = 1.0 - t;
+		s_other = t;
+	}
+	else
+	{
+		float theta = acos(cos_theta);
+		float sin_theta = sin(theta);
+		s_this = sin((1.0 - t) * theta) / sin_theta;
+		s_other = sin(t * theta) / sin_theta;
+	}
+	s_other *= sign;
+
+	return Quaternion(s_this * w() + s_other * other.w(), s_this * x() + s_other * other.x(),
+										s_this * y() + s_other * other.y(), s_this * z() + s_other * other.z())
+			.normalized();
+}
+
 const float& Quaternion::w() const
 {
 	return data_[0];
@@ -17,15 +17,8 @@ Octree::Octree(const std::string& filename) : Octree()
 	read(filename);
 }
 
-Octree::Octree(const Octree& other)
-	: Octree(other.resolution_, other.depth_levels_, other.automatic_pruning_enabled_,
-					 other.getOccupancyThres(), other.getFreeThres(), other.getProbHit(),
-					 other.getProbMiss(), other.getClampingThresMin(), other.getClampingThresMax())
+Octree::Octree(const Octree& other) : OctreeBase(other)
 {
-	// TODO: Is correct?
-	std::stringstream s(std::ios_base::in | std::ios_base::out | std::ios_base::binary);
-	other.write(s);
-	read(s);
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -83,19 +76,19 @@ bool Octree::readBinaryNodesRecurs(std::istream& s, InnerNode<OccupancyNode>& no
 				if (1 == children_data_1[i] && 0 == children_data_2[i])
 				{
 					// Free leaf
-					(*static_cast<std::array<OccupancyNode, 8>*>(node.children))[i].logit =
+					(*static_cast<std::array<OccupancyNode, 8>*>(node.getChildren()))[i].logit =
 							clamping_thres_min_log_;
 				}
 				else if (0 == children_data_1[i] && 1 == children_data_2[i])
 				{
 					// Occupied leaf
-					(*static_cast<std::array<OccupancyNode, 8>*>(node.children))[i].logit =
+					(*static_cast<std::array<OccupancyNode, 8>*>(node.getChildren()))[i].logit =
 							clamping_thres_max_log_;
 				}
 				else
 				{
 					// Unknown leaf
-					(*static_cast<std::array<OccupancyNode, 8>*>(node.children))[i].logit =
+					(*static_cast<std::array<OccupancyNode, 8>*>(node.getChildren()))[i].logit =
 							(occupancy_thres_log_ + free_thres_log_) / 2.0;
 				}
 			}
@@ -105,14 +98,15 @@ bool Octree::readBinaryNodesRecurs(std::istream& s, InnerNode<OccupancyNode>& no
 			for (unsigned int i = 0; i < 8; ++i)
 			{
 				InnerNode<OccupancyNode>& child =
-						(*static_cast<std::array<InnerNode<OccupancyNode>, 8>*>(node.children))[i];
+						(*static_cast<std::array<InnerNode<OccupancyNode>, 8>*>(
+								node.getChildren()))[i];
 				if (1 == children_data_1[i] && 0 == children_data_2[i])
 				{
 					// Free inner leaf
 					child.logit = clamping_thres_min_log_;
 					child.contains_free = true;
 					child.contains_unknown = false;
-					child.all_children_same = true;
+					child.setAllChildrenSame(true);
 				}
 				else if (0 == children_data_1[i] && 1 == children_data_2[i])
 				{
@@ -120,7 +114,7 @@ bool Octree::readBinaryNodesRecurs(std::istream& s, InnerNode<OccupancyNode>& no
 					child.logit = clamping_thres_max_log_;
 					child.contains_free = false;
 					child.contains_unknown = false;
-					child.all_children_same = true;
+					child.setAllChildrenSame(true);
 				}
 				else if (1 == children_data_1[i] && 1 == children_data_2[i])
 				{
@@ -134,7 +128,7 @@ bool Octree::readBinaryNodesRecurs(std::istream& s, InnerNode<OccupancyNode>& no
 					child.logit = (occupancy_thres_log_ + free_thres_log_) / 2.0;
 					child.contains_free = false;
 					child.contains_unknown = true;
-					child.all_children_same = true;
+					child.setAllChildrenSame(true);
 				}
 			}
 		}
@@ -158,7 +152,7 @@ bool Octree::writeBinaryNodesRecurs(std::ostream& s, const InnerNode<OccupancyNo
 			if (1 == current_depth)
 			{
 				const OccupancyNode& child =
-						(*static_cast<std::array<OccupancyNode, 8>*>(node.children))[i];
+						(*static_cast<std::array<OccupancyNode, 8>*>(node.getChildren()))[i];
 				if (isOccupiedLog(child.logit))
 				{
 					children_data_1[i] = 0;
@@ -173,7 +167,8 @@ bool Octree::writeBinaryNodesRecurs(std::ostream& s, const InnerNode<OccupancyNo
 			else
 			{
 				const InnerNode<OccupancyNode>& child =
-						(*static_cast<std::array<InnerNode<OccupancyNode>, 8>*>(node.children))[i];
+						(*static_cast<std::array<InnerNode<OccupancyNode>, 8>*>(
+								node.getChildren()))[i];
 				if (hasChildren(child) && !containsOnlySameType(child))
 				{
 					children_data_1[i] = 1;
@@ -215,7 +210,7 @@ bool Octree::writeBinaryNodesRecurs(std::ostream& s, const InnerNode<OccupancyNo
 	if (hasChildren(node) && 1 < current_depth)
 	{
 		for (const auto& child :
-				 *static_cast<std::array<InnerNode<OccupancyNode>, 8>*>(node.children))
+				 *static_cast<std::array<InnerNode<OccupancyNode>, 8>*>(node.getChildren()))
 		{
 			if (hasChildren(child) && !containsOnlySameType(child))
 			{
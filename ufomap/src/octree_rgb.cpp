@@ -24,15 +24,9 @@ OctreeRGB::OctreeRGB(const std::string& filename) : OctreeRGB()
 }
 
 OctreeRGB::OctreeRGB(const OctreeRGB& other)
-	: OctreeRGB(other.resolution_, other.depth_levels_, other.automatic_pruning_enabled_,
-							other.prune_consider_color_, other.getOccupancyThres(),
-							other.getFreeThres(), other.getProbHit(), other.getProbMiss(),
-							other.getClampingThresMin(), other.getClampingThresMax())
+	: OctreeBase(other)
+	, prune_consider_color_(other.prune_consider_color_)
 {
-	// TODO: Is correct?
-	std::stringstream s(std::ios_base::in | std::ios_base::out | std::ios_base::binary);
-	other.write(s);
-	read(s);
 }
 
 //
@@ -43,28 +37,44 @@ void OctreeRGB::insertPointCloud(const Point3& sensor_origin, const PointCloudRG
 																 float max_range)
 {
 	PointCloud no_color_cloud;
+	no_color_cloud.reserve(cloud.size());
 
-	CodeMap<std::vector<Color>> colors;
+	// Inserts running at the same time cannot share color_sums_
+	CodeMap<ColorSum> concurrent_color_sums;
+	CodeMap<ColorSum>& color_sums =
+			isConcurrencyEnabled() ? concurrent_color_sums : color_sums_;
 
 	for (const Point3RGB& point : cloud)
 	{
 		if (0 > max_range || (point - sensor_origin).norm() < max_range)
 		{
-			colors[Code(coordToKey(point))].push_back(point.getColor());
+			color_sums[Code(coordToKey(point))].add(point.getColor());
 			no_color_cloud.push_back(point);
 		}
 	}
 
-	OctreeBase<OccupancyNodeRGB>::insertPointCloud(sensor_origin, no_color_cloud,
-																								 max_range);
+	if (isConcurrencyEnabled())
+	{
+		OctreeBase<OccupancyNodeRGB>::insertPointCloud(sensor_origin, no_color_cloud,
+																									 max_range);
+	}
+	else
+	{
+		// The colors are set by updateLeafData in the same pass as the logits
+		LeafDataUpdate leaf_data_update(*this);
+		OctreeBase<OccupancyNodeRGB>::insertPointCloud(sensor_origin, no_color_cloud,
+																									 max_range);
+	}
 
-	for (const auto& [code, color] : colors)
+	// Voxels the update pass did not reach, e.g. inside an already saturated pruned node
+	for (const auto& [code, color_sum] : color_sums)
 	{
-		for (const Color& c : color)
+		if (!color_sum.applied)
 		{
-			integrateColor(code, c);
+			integrateColor(code, color_sum.average());
 		}
 	}
+	color_sums.clear();
 }
 
 void OctreeRGB::insertPointCloudDiscrete(const Point3& sensor_origin,
@@ -73,18 +83,18 @@ void OctreeRGB::insertPointCloudDiscrete(const Point3& sensor_origin,
 {
 	PointCloud no_color_cloud;
 
-	CodeMap<std::vector<Color>> colors;
+	CodeMap<ColorSum> colors;
 
 	for (const Point3RGB& point : cloud)
 	{
 		if (0 > max_range || (point - sensor_origin).norm() < max_range)
 		{
-			std::vector<Color>& color = colors[Code(coordToKey(point))];
-			if (color.empty())
+			ColorSum& color = colors[Code(coordToKey(point))];
+			if (0 == color.count)
 			{
 				no_color_cloud.push_back(point);
 			}
-			color.push_back(point.getColor());
+			color.add(point.getColor());
 		}
 	}
 
@@ -95,8 +105,8 @@ void OctreeRGB::insertPointCloudDiscrete(const Point3& sensor_origin,
 	{
 		if (isOccupied(code))  // TODO: Does this improve performance?
 		{
-			averageNodeColor(code, getAverageColor(color));
-			// integrateColor(code, getAverageColor(color));
+			averageNodeColor(code, color.average());
+			// integrateColor(code, color.average());
 		}
 	}
 }
@@ -150,33 +160,9 @@ Node<OccupancyNodeRGB> OctreeRGB::integrateColor(const Code& code, Color color)
 	Node<OccupancyNodeRGB> node = getNode(code, !prune_consider_color_);
 	if (nullptr != node.node && isOccupied(node) && node.node->color != color)
 	{
-		Color color_not_set;
-		if (node.node->color != color_not_set)
-		{
-			double node_prob = probability(node.node->logit);
-			double node_prob_inv = 0.99 - node_prob;
-
-			double node_color_r = static_cast<double>(node.node->color.r);
-			double node_color_g = static_cast<double>(node.node->color.g);
-			double node_color_b = static_cast<double>(node.node->color.b);
-
-			double color_r = static_cast<double>(color.r);
-			double color_g = static_cast<double>(color.g);
-			double color_b = static_cast<double>(color.b);
-
-			double r = std::sqrt(((node_color_r * node_color_r) * node_prob) +
-													 ((color_r * color_r) * node_prob_inv));
-			double g = std::sqrt(((node_color_g * node_color_g) * node_prob) +
-													 ((color_g * color_g) * node_prob_inv));
-			double b = std::sqrt(((node_color_b * node_color_b) * node_prob) +
-													 ((color_b * color_b) * node_prob_inv));
-
-			node = setNodeColorRecurs(code, Color(r, g, b), root_, depth_levels_).first;
-		}
-		else
-		{
-			return setNodeColorRecurs(code, color, root_, depth_levels_).first;
-		}
+		node = setNodeColorRecurs(code, getIntegratedColor(*node.node, color), root_,
+															depth_levels_)
+							 .first;
 	}
 	return node;
 }
@@ -202,6 +188,10 @@ OctreeRGB::setNodeColorRecurs(const Code& code, const Color& color,
 		{
 			createChildren(inner_node, current_depth);
 		}
+		else
+		{
+			makeChildrenUnique(inner_node, current_depth);
+		}
 
 		unsigned int child_depth = current_depth - 1;
 
@@ -211,9 +201,9 @@ OctreeRGB::setNodeColorRecurs(const Code& code, const Color& color,
 		// Get child
 		OccupancyNodeRGB* child_node =
 				(0 == child_depth) ? &(*static_cast<std::array<OccupancyNodeRGB, 8>*>(
-																 inner_node.children))[child_idx] :
+																 inner_node.getChildren()))[child_idx] :
 														 &(*static_cast<std::array<InnerNode<OccupancyNodeRGB>, 8>*>(
-																 inner_node.children))[child_idx];
+																 inner_node.getChildren()))[child_idx];
 
 		// Recurs
 		auto [child, changed] = setNodeColorRecurs(code, color, *child_node, child_depth);
@@ -240,15 +230,16 @@ OctreeRGB::setNodeColorRecurs(const Code& code, const Color& color,
 
 			if (hasChildren(inner_node))
 			{
+				makeChildrenUnique(inner_node, current_depth);
 				unsigned int child_depth = current_depth - 1;
 				for (unsigned int child_idx = 0; child_idx < 8; ++child_idx)
 				{
 					OccupancyNodeRGB* child_node =
 							(0 == child_depth) ?
 									&(*static_cast<std::array<OccupancyNodeRGB, 8>*>(
-											inner_node.children))[child_idx] :
+											inner_node.getChildren()))[child_idx] :
 									&(*static_cast<std::array<InnerNode<OccupancyNodeRGB>, 8>*>(
-											inner_node.children))[child_idx];
+											inner_node.getChildren()))[child_idx];
 					if (isOccupied(*child_node))
 					{
 						setNodeColorRecurs(code.getChild(child_idx), color, *child_node, child_depth);
@@ -268,6 +259,73 @@ OctreeRGB::setNodeColorRecurs(const Code& code, const Color& color,
 	}
 }
 
+//
+// Integrate color
+//
+
+Color OctreeRGB::getIntegratedColor(const OccupancyNodeRGB& node, const Color& color) const
+{
+	Color color_not_set;
+	if (node.color == color_not_set)
+	{
+		return color;
+	}
+
+	double node_prob = probability(node.logit);
+	double node_prob_inv = 0.99 - node_prob;
+
+	double node_color_r = static_cast<double>(node.color.r);
+	double node_color_g = static_cast<double>(node.color.g);
+	double node_color_b = static_cast<double>(node.color.b);
+
+	double color_r = static_cast<double>(color.r);
+	double color_g = static_cast<double>(color.g);
+	double color_b = static_cast<double>(color.b);
+
+	double r = std::sqrt(((node_color_r * node_color_r) * node_prob) +
+											 ((color_r * color_r) * node_prob_inv));
+	double g = std::sqrt(((node_color_g * node_color_g) * node_prob) +
+											 ((color_g * color_g) * node_prob_inv));
+	double b = std::sqrt(((node_color_b * node_color_b) * node_prob) +
+											 ((color_b * color_b) * node_prob_inv));
+
+	return Color(r, g, b);
+}
+
+//
+// Update leaf data
+//
+
+bool OctreeRGB::updateLeafData(OccupancyNodeRGB& leaf, const Code& code,
+															 float logit_update)
+{
+	// Only hits have a color
+	if (0 >= logit_update)
+	{
+		return false;
+	}
+
+	auto it = color_sums_.find(code);
+	if (color_sums_.end() == it)
+	{
+		return false;
+	}
+	it->second.applied = true;
+
+	if (!isOccupied(leaf))
+	{
+		return false;
+	}
+
+	Color color = it->second.average();
+	if (leaf.color == color)
+	{
+		return false;
+	}
+	leaf.color = getIntegratedColor(leaf, color);
+	return true;
+}
+
 //
 // Node collapsible
 //
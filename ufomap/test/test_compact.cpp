@@ -0,0 +1,122 @@
+#include <ufomap/octree.h>
+#include <ufomap/octree_rgb.h>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+#include "test_scenes.h"
+
+using namespace ufomap;
+using ufomap::test::makeScan;
+using ufomap::test::serialize;
+
+namespace
+{
+Point3 sensorOrigin(unsigned int scan)
+{
+	float angle = 0.3 * scan;
+	return Point3(4 * std::cos(angle), 4 * std::sin(angle), 0.1);
+}
+
+// Scans along a circle, so nodes are split and pruned a lot
+template <typename TREE>
+void insertScans(TREE& tree, unsigned int first, unsigned int last)
+{
+	for (unsigned int i = first; i < last; ++i)
+	{
+		tree.insertPointCloud(sensorOrigin(i), makeScan(i, 5000, 6.0, sensorOrigin(i)), 5.0);
+	}
+}
+}  // namespace
+
+TEST(Compact, SameMap)
+{
+	Octree tree(0.05, 16);
+	insertScans(tree, 0, 20);
+
+	std::string before = serialize(tree);
+	size_t size = tree.size();
+	size_t memory_nodes = tree.memoryUsageNodes();
+
+	EXPECT_TRUE(tree.compact());
+	EXPECT_FALSE(tree.isCompacting());
+	EXPECT_EQ(before, serialize(tree));
+	EXPECT_EQ(size, tree.size());
+	EXPECT_EQ(memory_nodes, tree.memoryUsageNodes());
+
+	// And it keeps working
+	Octree reference(0.05, 16);
+	insertScans(reference, 0, 25);
+	insertScans(tree, 20, 25);
+	EXPECT_EQ(serialize(reference), serialize(tree));
+}
+
+TEST(Compact, Incremental)
+{
+	Octree tree(0.05, 16);
+	Octree reference(0.05, 16);
+	insertScans(tree, 0, 20);
+	insertScans(reference, 0, 20);
+
+	// Changed while compacting
+	unsigned int slices = 0;
+	unsigned int scan = 20;
+	while (!tree.compact(std::chrono::microseconds(100)))
+	{
+		ASSERT_TRUE(tree.isCompacting());
+		ASSERT_GT(100000u, ++slices);
+		if (0 == slices % 10 && scan < 30)
+		{
+			insertScans(tree, scan, scan + 1);
+			insertScans(reference, scan, scan + 1);
+			++scan;
+		}
+	}
+	EXPECT_FALSE(tree.isCompacting());
+	EXPECT_EQ(serialize(reference), serialize(tree));
+
+	// Cleared while compacting
+	insertScans(tree, 30, 32);
+	tree.compact(std::chrono::microseconds(1));
+	tree.clear();
+	EXPECT_FALSE(tree.isCompacting());
+	EXPECT_TRUE(tree.compact());
+	EXPECT_EQ(serialize(Octree(0.05, 16)), serialize(tree));
+}
+
+TEST(Compact, Color)
+{
+	OctreeRGB tree(0.05, 16);
+	PointCloud scan = makeScan(1, 5000, 6.0);
+	PointCloudRGB cloud;
+	for (size_t i = 0; i < scan.size(); ++i)
+	{
+		cloud.push_back(Point3RGB(scan[i], Color(i % 256, (i / 256) % 256, 128)));
+	}
+	tree.insertPointCloud(Point3(0, 0, 0), cloud);
+
+	std::string before = serialize(tree);
+	EXPECT_TRUE(tree.compact());
+	EXPECT_EQ(before, serialize(tree));
+}
+
+TEST(Compact, NotWithCopies)
+{
+	Octree tree(0.05, 16);
+	insertScans(tree, 0, 5);
+	{
+		auto snapshot = tree.snapshot();
+		EXPECT_THROW(tree.compact(), std::invalid_argument);
+		EXPECT_FALSE(tree.isCompacting());
+		EXPECT_EQ(serialize(*snapshot), serialize(tree));
+	}
+	EXPECT_TRUE(tree.compact());
+
+	tree.enableConcurrency();
+	EXPECT_THROW(tree.compact(), std::invalid_argument);
+	tree.enableConcurrency(false);
+	EXPECT_TRUE(tree.compact());
+}
@@ -0,0 +1,132 @@
+#include <ufomap/octree.h>
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "test_scenes.h"
+
+using namespace ufomap;
+using ufomap::test::makeScan;
+using ufomap::test::serialize;
+
+namespace
+{
+const Point3 origins[] = {Point3(0, 0, 0.5), Point3(2, -1, 0.5), Point3(-1, 3, 0.3),
+													Point3(1, 1, 0.4)};
+}  // namespace
+
+TEST(InsertThreads, PointCloud)
+{
+	Octree serial(0.1, 16);
+	Octree threaded(0.1, 16);
+	threaded.setNumThreads(4);
+	for (size_t i = 0; i < 4; ++i)
+	{
+		PointCloud cloud = makeScan(i, 20000, 8.0, origins[i]);
+		serial.insertPointCloud(origins[i], cloud, 6.0);
+		threaded.insertPointCloud(origins[i], cloud, 6.0);
+	}
+	EXPECT_EQ(serialize(serial), serialize(threaded));
+}
+
+TEST(InsertThreads, PointCloudSoA)
+{
+	Octree serial(0.1, 16);
+	Octree threaded(0.1, 16);
+	threaded.setNumThreads(4);
+	for (size_t i = 0; i < 4; ++i)
+	{
+		PointCloudSoA cloud(makeScan(i, 20000, 8.0, origins[i]));
+		serial.insertPointCloud(origins[i], cloud);
+		threaded.insertPointCloud(origins[i], cloud);
+	}
+	EXPECT_EQ(serialize(serial), serialize(threaded));
+}
+
+TEST(InsertThreads, SensorOrigins)
+{
+	PointCloud cloud;
+	std::vector<Point3> sensor_origins;
+	for (size_t i = 0; i < 4; ++i)
+	{
+		for (const Point3& point : makeScan(i, 5000, 8.0, origins[i]))
+		{
+			cloud.push_back(point);
+			sensor_origins.push_back(origins[i]);
+		}
+	}
+
+	Octree serial(0.1, 16);
+	Octree threaded(0.1, 16);
+	threaded.setNumThreads(4);
+	serial.insertPointCloud(sensor_origins, cloud, 6.0);
+	threaded.insertPointCloud(sensor_origins, cloud, 6.0);
+	EXPECT_EQ(serialize(serial), serialize(threaded));
+}
+
+TEST(InsertThreads, Discrete)
+{
+	for (unsigned int depth : {0, 2})
+	{
+		Octree serial(0.1, 16);
+		Octree threaded(0.1, 16);
+		threaded.setNumThreads(4);
+		for (size_t i = 0; i < 4; ++i)
+		{
+			PointCloud cloud = makeScan(i, 20000, 8.0, origins[i]);
+			serial.insertPointCloudDiscrete(origins[i], cloud, 6.0, 2, depth);
+			threaded.insertPointCloudDiscrete(origins[i], cloud, 6.0, 2, depth);
+		}
+		EXPECT_EQ(serialize(serial), serialize(threaded)) << "depth " << depth;
+	}
+}
+
+TEST(InsertThreads, Concurrent)
+{
+	// The sensors are far apart, so the result does not depend on the order the writers
+	// update the shared nodes in
+	std::vector<Point3> sensors;
+	std::vector<std::vector<PointCloud>> clouds;
+	for (size_t w = 0; w < 4; ++w)
+	{
+		sensors.push_back(Point3(30.0 * (w % 2) - 15, 30.0 * (w / 2) - 15, 0.5));
+		clouds.emplace_back();
+		for (size_t s = 0; s < 3; ++s)
+		{
+			clouds.back().push_back(makeScan(10 * w + s, 5000, 10.0, sensors.back()));
+		}
+	}
+
+	Octree serial(0.1, 16);
+	for (size_t w = 0; w < sensors.size(); ++w)
+	{
+		for (const PointCloud& cloud : clouds[w])
+		{
+			serial.insertPointCloud(sensors[w], cloud);
+		}
+	}
+
+	Octree concurrent(0.1, 16);
+	concurrent.enableConcurrency();
+	std::vector<std::thread> writers;
+	for (size_t w = 0; w < sensors.size(); ++w)
+	{
+		writers.emplace_back([&, w]() {
+			for (const PointCloud& cloud : clouds[w])
+			{
+				concurrent.insertPointCloud(sensors[w], cloud);
+			}
+		});
+	}
+	for (std::thread& writer : writers)
+	{
+		writer.join();
+	}
+	concurrent.enableConcurrency(false);
+	// Pruning was deferred while concurrent
+	concurrent.prune();
+
+	EXPECT_EQ(serialize(serial), serialize(concurrent));
+}
@@ -0,0 +1,143 @@
+#include <ufomap/octree.h>
+#include <ufomap/octree_quantized.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+
+#include "test_scenes.h"
+
+using namespace ufomap;
+using ufomap::test::makeScan;
+
+TEST(QuantizedLogit, Saturates)
+{
+	using Q8 = QuantizedLogit<int8_t, 32>;
+	EXPECT_EQ(std::numeric_limits<int8_t>::max(), Q8(100.0).value);
+	EXPECT_EQ(std::numeric_limits<int8_t>::min(), Q8(-100.0).value);
+	EXPECT_EQ(std::numeric_limits<int8_t>::max(),
+						Q8(std::numeric_limits<float>::max()).value);
+	EXPECT_EQ(std::numeric_limits<int8_t>::min(),
+						Q8(std::numeric_limits<float>::lowest()).value);
+	EXPECT_FLOAT_EQ(127.0 / 32, Q8(4.0));
+	EXPECT_FLOAT_EQ(-4.0, Q8(-4.0));
+
+	using Q16 = QuantizedLogit<int16_t, 1024>;
+	EXPECT_EQ(std::numeric_limits<int16_t>::max(), Q16(100.0).value);
+	EXPECT_EQ(std::numeric_limits<int16_t>::min(), Q16(-100.0).value);
+	EXPECT_FLOAT_EQ(-32.0, Q16(-32.0));
+}
+
+TEST(QuantizedLogit, Rounds)
+{
+	using Q8 = QuantizedLogit<int8_t, 32>;
+	EXPECT_EQ(0, Q8(0.4 / 32).value);
+	EXPECT_EQ(1, Q8(0.6 / 32).value);
+	EXPECT_EQ(-1, Q8(-0.6 / 32).value);
+	EXPECT_EQ(-3, Q8(-3.0 / 32).value);
+	// The steps are exact as floats
+	for (int i = -128; i <= 127; ++i)
+	{
+		ASSERT_EQ(i, Q8(i / 32.0f).value);
+	}
+}
+
+template <typename TREE>
+class Quantized : public ::testing::Test
+{
+};
+
+using QuantizedTrees = ::testing::Types<OctreeQ8, OctreeQ16>;
+TYPED_TEST_SUITE(Quantized, QuantizedTrees);
+
+TYPED_TEST(Quantized, ClampingThresholdsAreNodeValues)
+{
+	// The default thresholds, and thresholds outside of what Q8 can store
+	for (float clamping_thres_max : {0.971f, 0.9999f})
+	{
+		TypeParam tree(0.1, 16, true, 0.5, 0.5, 0.7, 0.4, 0.0001, clamping_thres_max);
+		EXPECT_EQ(TypeParam::toNodeLogit(tree.getClampingThresMaxLog()),
+							tree.getClampingThresMaxLog());
+		EXPECT_EQ(TypeParam::toNodeLogit(tree.getClampingThresMinLog()),
+							tree.getClampingThresMinLog());
+	}
+}
+
+TYPED_TEST(Quantized, SaturatesAtClampingThresholds)
+{
+	for (float clamping_thres_max : {0.971f, 0.9999f})
+	{
+		TypeParam tree(0.1, 16, false, 0.5, 0.5, 0.7, 0.4, 0.0001, clamping_thres_max);
+
+		const Point3 occupied(1.05, 0.05, 0.05);
+		const Point3 free(-1.05, 0.05, 0.05);
+		for (int i = 0; i < 200; ++i)
+		{
+			tree.integrateHit(occupied);
+			tree.integrateMiss(free);
+			ASSERT_LE(tree.logit(tree.getNode(occupied)), tree.getClampingThresMaxLog());
+			ASSERT_GE(tree.logit(tree.getNode(free)), tree.getClampingThresMinLog());
+		}
+		EXPECT_EQ(tree.getClampingThresMaxLog(), tree.logit(tree.getNode(occupied)));
+		EXPECT_EQ(tree.getClampingThresMinLog(), tree.logit(tree.getNode(free)));
+
+		// Stays there
+		tree.integrateHit(occupied);
+		tree.integrateMiss(free);
+		EXPECT_EQ(tree.getClampingThresMaxLog(), tree.logit(tree.getNode(occupied)));
+		EXPECT_EQ(tree.getClampingThresMinLog(), tree.logit(tree.getNode(free)));
+
+		// And the way back
+		for (int i = 0; i < 200; ++i)
+		{
+			tree.integrateMiss(occupied);
+			tree.integrateHit(free);
+		}
+		EXPECT_EQ(tree.getClampingThresMinLog(), tree.logit(tree.getNode(occupied)));
+		EXPECT_EQ(tree.getClampingThresMaxLog(), tree.logit(tree.getNode(free)));
+	}
+}
+
+TYPED_TEST(Quantized, PointCloudSaturates)
+{
+	TypeParam tree(0.1, 16);
+	const Point3 origin(0, 0, 0.5);
+	PointCloud cloud = makeScan(1, 2000, 6.0, origin);
+	for (int i = 0; i < 100; ++i)
+	{
+		tree.insertPointCloud(origin, cloud);
+	}
+
+	for (const Point3& point : cloud)
+	{
+		ASSERT_EQ(tree.getClampingThresMaxLog(), tree.logit(tree.getNode(point)));
+	}
+	// The voxel of the origin is only ever missed
+	EXPECT_EQ(tree.getClampingThresMinLog(), tree.logit(tree.getNode(origin)));
+}
+
+TEST(QuantizedQ16, SameClassificationAsOctree)
+{
+	// Q16 is fine enough that the rounding does not change whether a voxel is occupied
+	OctreeQ16 tree(0.1, 16);
+	Octree reference(0.1, 16);
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		const Point3 origin(0.5 * i, -0.3 * i, 0.5);
+		PointCloud cloud = makeScan(i, 5000, 8.0, origin);
+		tree.insertPointCloud(origin, cloud);
+		reference.insertPointCloud(origin, cloud);
+	}
+
+	size_t num = 0;
+	for (auto it = reference.begin_leafs(true, true, false, false, 0);
+			 it != reference.end_leafs(); ++it, ++num)
+	{
+		Point3 center = it.getCenter();
+		ASSERT_EQ(reference.isOccupied(center), tree.isOccupied(center));
+		ASSERT_NEAR(reference.logit(reference.getNode(center)),
+								tree.logit(tree.getNode(center)), 0.01);
+	}
+	EXPECT_LT(0, num);
+}
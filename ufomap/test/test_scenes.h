@@ -0,0 +1,58 @@
+#ifndef UFOMAP_TEST_SCENES_H
+#define UFOMAP_TEST_SCENES_H
+
+#include <ufomap/point_cloud.h>
+#include <ufomap/types.h>
+
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace ufomap
+{
+namespace test
+{
+/**
+ * @brief A scan of a room like scene, a ring of walls around center with points spread
+ * out in between
+ *
+ * @param seed The seed of the random numbers
+ * @param num_points The number of points
+ * @param range The distance from center to the walls
+ * @param center The center of the scan
+ */
+inline PointCloud makeScan(unsigned int seed, size_t num_points, float range = 8.0,
+													 const Point3& center = Point3(0, 0, 0))
+{
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> dist(-1, 1);
+
+	PointCloud cloud;
+	cloud.reserve(num_points);
+	for (size_t i = 0; i < num_points; ++i)
+	{
+		float yaw = dist(gen) * M_PI;
+		float pitch = dist(gen) * 0.4;
+		float distance = 0 == i % 7 ? range : range * (0.5 + 0.5 * std::fabs(dist(gen)));
+		cloud.push_back(center + Point3(distance * std::cos(pitch) * std::cos(yaw),
+																		distance * std::cos(pitch) * std::sin(yaw),
+																		distance * std::sin(pitch)));
+	}
+	return cloud;
+}
+
+/**
+ * @brief The map written to a string, two maps are the same if their strings are
+ */
+template <typename TREE>
+std::string serialize(const TREE& tree)
+{
+	std::stringstream data;
+	tree.writeData(data);
+	return data.str();
+}
+}  // namespace test
+}  // namespace ufomap
+
+#endif  // UFOMAP_TEST_SCENES_H
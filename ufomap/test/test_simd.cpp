@@ -0,0 +1,133 @@
+#include <ufomap/code.h>
+#include <ufomap/octree.h>
+#include <ufomap/point_cloud_soa.h>
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "test_scenes.h"
+
+using namespace ufomap;
+using ufomap::test::makeScan;
+
+// The batched functions below use AVX2 and BMI2 when built with UFOMAP_AVX2 and the
+// scalar code otherwise. Either way they have to match the functions that handle one
+// element at a time. The sizes are not multiples of the vector widths, so the scalar
+// tails are tested as well.
+
+TEST(Simd, KeysToCodes)
+{
+	std::mt19937 gen(1);
+	std::uniform_int_distribution<KeyType> dist(0, (KeyType(1) << 21) - 1);
+
+	const size_t num = 1003;
+	std::vector<KeyType> x(num), y(num), z(num);
+	for (size_t i = 0; i < num; ++i)
+	{
+		x[i] = dist(gen);
+		y[i] = dist(gen);
+		z[i] = dist(gen);
+	}
+	// The extremes
+	x[0] = y[1] = z[2] = 0;
+	x[3] = y[3] = z[3] = (KeyType(1) << 21) - 1;
+
+	std::vector<uint64_t> codes(num);
+	Code::toCodes(x.data(), y.data(), z.data(), codes.data(), num);
+	for (size_t i = 0; i < num; ++i)
+	{
+		Key key(x[i], y[i], z[i], 0);
+		ASSERT_EQ(Code(key).getCode(), codes[i]) << "index " << i;
+		ASSERT_EQ(key, Code(codes[i], 0).toKey()) << "index " << i;
+	}
+}
+
+TEST(Simd, CoordsToKeys)
+{
+	Octree tree(0.1, 16);
+
+	std::mt19937 gen(2);
+	std::uniform_real_distribution<float> dist(-100, 100);
+
+	std::vector<float> coords;
+	for (size_t i = 0; i < 999; ++i)
+	{
+		coords.push_back(dist(gen));
+	}
+	// On and next to voxel borders, and around the origin
+	for (int i = -20; i <= 20; ++i)
+	{
+		coords.push_back(i * 0.1f);
+		coords.push_back(std::nextafter(i * 0.1f, -1000.0f));
+		coords.push_back(std::nextafter(i * 0.1f, 1000.0f));
+	}
+
+	std::vector<KeyType> keys(coords.size());
+	tree.coordsToKeys(coords.data(), keys.data(), coords.size());
+	for (size_t i = 0; i < coords.size(); ++i)
+	{
+		ASSERT_EQ(tree.coordToKey(coords[i], 0), keys[i]) << "coord " << coords[i];
+	}
+
+	PointCloud cloud = makeScan(3, 1001, 20.0, Point3(0.05, -3, 1));
+	std::vector<uint64_t> codes;
+	tree.coordsToCodes(cloud, codes);
+	ASSERT_EQ(cloud.size(), codes.size());
+	for (size_t i = 0; i < cloud.size(); ++i)
+	{
+		ASSERT_EQ(Code(tree.coordToKey(cloud[i], 0)).getCode(), codes[i]) << "index " << i;
+	}
+}
+
+TEST(Simd, Transform)
+{
+	RigidTransform transform(ufomap_math::Pose6(1.5, -2, 0.3, 0.1, -0.2, 2.5));
+
+	PointCloudSoA cloud(makeScan(4, 1005));
+	std::vector<float> x(cloud.size()), y(cloud.size()), z(cloud.size());
+	transform(cloud.x().data(), cloud.y().data(), cloud.z().data(), x.data(), y.data(),
+						z.data(), cloud.size());
+	for (size_t i = 0; i < cloud.size(); ++i)
+	{
+		Point3 point = transform(cloud[i]);
+		EXPECT_FLOAT_EQ(point[0], x[i]);
+		EXPECT_FLOAT_EQ(point[1], y[i]);
+		EXPECT_FLOAT_EQ(point[2], z[i]);
+	}
+}
+
+TEST(Simd, RayBatch)
+{
+	Octree tree(0.1, 16);
+
+	const Point3 origin(0.03, -0.12, 0.51);
+	std::vector<Point3> ends;
+	for (const Point3& end : makeScan(5, 203, 12.0, origin))
+	{
+		ends.push_back(end);
+	}
+	// Along the axes, where some of the rays never step in one direction
+	ends.push_back(origin + Point3(5, 0, 0));
+	ends.push_back(origin + Point3(0, -5, 0));
+	ends.push_back(origin + Point3(0, 0, 5));
+	// Ending in the voxel it starts in
+	ends.push_back(origin + Point3(0.01, 0, 0));
+
+	for (unsigned int depth : {0, 2})
+	{
+		for (float max_range : {-1.0f, 7.0f})
+		{
+			std::vector<KeyRay> rays;
+			tree.computeRays(origin, ends, rays, max_range, depth);
+			ASSERT_EQ(ends.size(), rays.size());
+			for (size_t i = 0; i < ends.size(); ++i)
+			{
+				KeyRay ray;
+				tree.computeRay(origin, ends[i], ray, max_range, depth);
+				ASSERT_EQ(ray, rays[i]) << "ray " << i << " depth " << depth;
+			}
+		}
+	}
+}
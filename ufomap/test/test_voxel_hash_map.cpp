@@ -0,0 +1,137 @@
+#include <ufomap/octree.h>
+#include <ufomap/octree_quantized.h>
+#include <ufomap/voxel_hash_map.h>
+
+#include <gtest/gtest.h>
+
+#include <iterator>
+#include <stdexcept>
+
+#include "test_scenes.h"
+
+using namespace ufomap;
+using ufomap::test::makeScan;
+using ufomap::test::serialize;
+
+namespace
+{
+Point3 sensorOrigin(unsigned int scan)
+{
+	return Point3(0.1 * scan, 0.05 * scan, 0.02);
+}
+}  // namespace
+
+TEST(VoxelHashMap, SameAsOctree)
+{
+	for (float max_range : {-1.0f, 2.5f})
+	{
+		Octree octree(0.05, 16);
+		VoxelHashMap map(0.05, 16);
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			PointCloud cloud = makeScan(i, 10000, 3.0, sensorOrigin(i));
+			octree.insertPointCloud(sensorOrigin(i), cloud, max_range);
+			if (0 == i % 2)
+			{
+				map.insertPointCloud(sensorOrigin(i), cloud, max_range);
+			}
+			else
+			{
+				map.insertPointCloud(sensorOrigin(i), PointCloudSoA(cloud), max_range);
+			}
+		}
+
+		size_t num = 0;
+		for (auto it = map.begin_leafs(), end = map.end_leafs(); it != end; ++it, ++num)
+		{
+			ASSERT_EQ(octree.logit(octree.getNode(it.getCenter())), it.getLogit());
+		}
+		EXPECT_LT(0, num);
+
+		Octree converted;
+		map.toOctree(converted);
+		EXPECT_EQ(serialize(octree), serialize(converted)) << "max range " << max_range;
+	}
+}
+
+TEST(VoxelHashMap, FrameOrigin)
+{
+	const ufomap_math::Pose6 frame_origin(0.3, -0.2, 0.1, 0, 0, 0.7);
+
+	Octree octree(0.05, 16);
+	VoxelHashMap map(0.05, 16);
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		PointCloud cloud = makeScan(i, 10000, 3.0);
+		octree.insertPointCloud(sensorOrigin(i), cloud, frame_origin, 2.5);
+		map.insertPointCloud(sensorOrigin(i), cloud, frame_origin, 2.5);
+	}
+
+	Octree converted;
+	map.toOctree(converted);
+	EXPECT_EQ(serialize(octree), serialize(converted));
+}
+
+TEST(VoxelHashMap, Discrete)
+{
+	for (float max_range : {-1.0f, 2.5f})
+	{
+		Octree octree(0.05, 16);
+		VoxelHashMap map(0.05, 16);
+		for (unsigned int i = 0; i < 6; ++i)
+		{
+			PointCloud cloud = makeScan(i, 10000, 3.0, sensorOrigin(i));
+			octree.insertPointCloudDiscrete(sensorOrigin(i), cloud, max_range);
+			if (0 == i % 2)
+			{
+				map.insertPointCloudDiscrete(sensorOrigin(i), cloud, max_range);
+			}
+			else
+			{
+				map.insertPointCloudDiscrete(sensorOrigin(i), PointCloudSoA(cloud), max_range);
+			}
+		}
+
+		Octree converted;
+		map.toOctree(converted);
+		EXPECT_EQ(serialize(octree), serialize(converted)) << "max range " << max_range;
+	}
+
+	VoxelHashMap map;
+	EXPECT_THROW(map.insertPointCloudDiscrete(Point3(0, 0, 0), makeScan(0, 10), -1, 1, 0),
+							 std::invalid_argument);
+	EXPECT_THROW(map.insertPointCloudDiscrete(Point3(0, 0, 0), makeScan(0, 10), -1, 0, 2),
+							 std::invalid_argument);
+}
+
+TEST(VoxelHashMap, RoundTrip)
+{
+	Octree octree(0.05, 16);
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		octree.insertPointCloud(sensorOrigin(i), makeScan(i, 10000, 3.0, sensorOrigin(i)));
+	}
+
+	// Pruned free nodes in the octree are split into voxels and merged again
+	VoxelHashMap map(0.2, 8);
+	map.fromOctree(octree);
+	EXPECT_EQ(octree.getResolution(), map.getResolution());
+
+	Octree converted(0.1, 10);
+	map.toOctree(converted);
+	EXPECT_EQ(serialize(octree), serialize(converted));
+
+	// And through a map with quantized logits, which stores the default thresholds exactly
+	OctreeQ16 quantized;
+	map.toOctree(quantized);
+	VoxelHashMap from_quantized;
+	from_quantized.fromOctree(quantized);
+	size_t num = 0;
+	for (auto it = map.begin_leafs(), end = map.end_leafs(); it != end; ++it, ++num)
+	{
+		ASSERT_NEAR(it.getLogit(), from_quantized.getNode(it.getCenter()).node->logit,
+								0.5 / 1024);
+	}
+	EXPECT_EQ(map.numBlocks(), from_quantized.numBlocks());
+	EXPECT_EQ(num, std::distance(from_quantized.begin_leafs(), from_quantized.end_leafs()));
+}
@@ -0,0 +1,163 @@
+#ifndef UFOMAP_MAPPING_BOUNDED_QUEUE_H
+#define UFOMAP_MAPPING_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace ufomap_mapping
+{
+/**
+ * @brief What to do when an element is pushed to a full queue
+ *
+ */
+enum class QueuePolicy
+{
+	// Remove the oldest element to make room for the new one
+	DROP_OLDEST,
+	// Throw away the new element
+	DROP_NEWEST,
+	// Merge the new element into the newest element, drop oldest if it cannot be merged
+	MERGE
+};
+
+/**
+ * @brief FIFO queue with a maximum size, for handing work from one thread to another.
+ *
+ * @tparam T The type of the elements
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : capacity_(0 == capacity ? 1 : capacity)
+	{
+	}
+
+	/**
+	 * @brief Add an element to the back of the queue
+	 *
+	 * @param value The element
+	 * @param policy What to do if the queue is full
+	 * @param merge Function bool(T& newest, T& value) that merges value into the newest
+	 * element in the queue, returning false if the two cannot be merged
+	 * @return size_t The number of elements that were dropped (0 or 1)
+	 */
+	template <typename MERGE>
+	size_t push(T&& value, QueuePolicy policy, MERGE merge)
+	{
+		size_t dropped = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (closed_)
+			{
+				return 1;
+			}
+
+			if (capacity_ <= queue_.size())
+			{
+				if (QueuePolicy::DROP_NEWEST == policy)
+				{
+					return 1;
+				}
+				if (QueuePolicy::MERGE == policy && merge(queue_.back(), value))
+				{
+					// Nothing new to wake up for
+					return 0;
+				}
+				while (capacity_ <= queue_.size())
+				{
+					queue_.pop_front();
+					++dropped;
+				}
+			}
+			queue_.push_back(std::move(value));
+		}
+		cv_.notify_one();
+		return dropped;
+	}
+
+	/**
+	 * @brief Add an element to the back of the queue, full queues never merge
+	 */
+	size_t push(T&& value, QueuePolicy policy)
+	{
+		return push(std::move(value),
+								QueuePolicy::MERGE == policy ? QueuePolicy::DROP_OLDEST : policy,
+								[](T&, T&) { return false; });
+	}
+
+	/**
+	 * @brief Take the element at the front of the queue, waits until there is one
+	 *
+	 * @param value Where the element is moved to
+	 * @return true If an element was taken
+	 * @return false If the queue has been closed and is empty
+	 */
+	bool pop(T& value)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+		if (queue_.empty())
+		{
+			return false;
+		}
+		value = std::move(queue_.front());
+		queue_.pop_front();
+		return true;
+	}
+
+	/**
+	 * @brief Wake up all waiting threads, after this pop returns false once the queue is
+	 * empty and push drops everything
+	 */
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		cv_.notify_all();
+	}
+
+	size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return queue_.size();
+	}
+
+	size_t capacity() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return capacity_;
+	}
+
+	/**
+	 * @brief Change the maximum size, elements over the new size are dropped from the front
+	 *
+	 * @return size_t The number of elements that were dropped
+	 */
+	size_t setCapacity(size_t capacity)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		capacity_ = 0 == capacity ? 1 : capacity;
+		size_t dropped = 0;
+		while (capacity_ < queue_.size())
+		{
+			queue_.pop_front();
+			++dropped;
+		}
+		return dropped;
+	}
+
+private:
+	std::deque<T> queue_;
+	size_t capacity_;
+	bool closed_ = false;
+	mutable std::mutex mutex_;
+	std::condition_variable cv_;
+};
+}  // namespace ufomap_mapping
+
+#endif  // UFOMAP_MAPPING_BOUNDED_QUEUE_H
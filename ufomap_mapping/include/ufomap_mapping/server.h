@@ -5,12 +5,19 @@
 #include <ufomap/octree.h>
 
 #include <ufomap_mapping/ServerConfig.h>
+#include <ufomap_mapping/bounded_queue.h>
 
 #include <dynamic_reconfigure/server.h>
 #include <sensor_msgs/PointCloud2.h>
 #include <tf2_ros/transform_listener.h>
 #include <tf2_sensor_msgs/tf2_sensor_msgs.h>
 
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace ufomap_mapping
 {
 class UFOMapServer
@@ -18,9 +25,67 @@ class UFOMapServer
 public:
 	UFOMapServer(ros::NodeHandle& nh, ros::NodeHandle& nh_priv);
 
+	~UFOMapServer();
+
 private:
+	//
+	// Pipeline
+	//
+
+	// Cloud waiting to be converted
+	struct RawCloud
+	{
+		sensor_msgs::PointCloud2::ConstPtr msg;
+		ros::WallTime received;
+		ros::WallTime enqueued;
+	};
+
+	// Cloud waiting for its transform
+	struct ConvertedCloud
+	{
+		std_msgs::Header header;
+		ufomap::PointCloud cloud;
+		ros::WallTime received;
+		ros::WallTime enqueued;
+	};
+
+	// Cloud in the map frame waiting to be integrated
+	struct TransformedCloud
+	{
+		ufomap_math::Pose6 transform;
+		ufomap::PointCloud cloud;
+		ros::WallTime received;
+		ros::WallTime enqueued;
+	};
+
+	struct StageStats
+	{
+		// Seconds from entering the queue of the stage until done, last cloud
+		std::atomic<double> latency{ 0.0 };
+		// Number of clouds dropped from the queue of the stage
+		std::atomic<size_t> dropped{ 0 };
+	};
+
 	void cloudCallback(const sensor_msgs::PointCloud2::ConstPtr& msg);
 
+	void conversionWorker();
+
+	void transformWorker();
+
+	void integrationWorker();
+
+	static bool mergeClouds(TransformedCloud& newest, TransformedCloud& cloud,
+													float max_distance);
+
+	void computeEndpointCodes(const TransformedCloud& transformed, float max_range,
+														unsigned int depth, std::vector<uint64_t>& codes);
+
+	bool isDuplicateScan(const ufomap_math::Pose6& transform,
+											 const std::vector<uint64_t>& codes, float max_translation,
+											 float max_rotation, float min_overlap) const;
+
+	void publishPipelineStats();
+
 	void timerCallback(const ros::TimerEvent& event);
 
 	void configCallback(ufomap_mapping::ServerConfig& config, uint32_t level);
@@ -34,6 +99,7 @@ private:
 	ros::Publisher map_pub_;
 	ros::Publisher map_binary_pub_;
 	ros::Publisher cloud_pub_;
+	ros::Publisher pipeline_stats_pub_;
 
 	ros::Timer pub_timer_;
 
@@ -50,6 +116,35 @@ private:
 	dynamic_reconfigure::Server<ufomap_mapping::ServerConfig>::CallbackType f_;
 
 	ufomap::Octree map_;
+	// Protects map_ between the integration worker and the publishing, not needed when
+	// concurrency is enabled on map_
+	std::mutex map_mutex_;
+
+	// Pipeline: cloudCallback -> conversion -> transform -> integration
+	BoundedQueue<RawCloud> conversion_queue_;
+	BoundedQueue<ConvertedCloud> transform_queue_;
+	BoundedQueue<TransformedCloud> integration_queue_;
+	StageStats conversion_stats_;
+	StageStats transform_stats_;
+	StageStats integration_stats_;
+	// Seconds from the cloud was received until it was integrated, last cloud
+	std::atomic<double> total_latency_{ 0.0 };
+	// Number of clouds skipped because they were duplicates of the last integrated cloud
+	std::atomic<size_t> duplicates_skipped_{ 0 };
+	std::thread conversion_thread_;
+	std::thread transform_thread_;
+	std::thread integration_thread_;
+
+	// Scan deduplication, only used by the integration worker
+	bool has_last_scan_ = false;
+	ufomap_math::Pose6 last_scan_transform_;  // Transform of the last integrated cloud
+	std::vector<uint64_t> last_scan_codes_;   // Sorted endpoint codes of the same cloud
+	std::vector<uint64_t> scan_codes_;        // Sorted endpoint codes of the current cloud
+	std::vector<uint64_t> scan_codes_buffer_;
+	unsigned int num_duplicates_in_row_ = 0;
+
+	// Protects the configureable variables, which are read by the workers
+	mutable std::mutex config_mutex_;
 
 	// Configureable variables
 
@@ -73,6 +168,16 @@ private:
 	unsigned int map_queue_size_;
 	unsigned int map_binary_queue_size_;
 	unsigned int map_cloud_queue_size_;
+
+	QueuePolicy pipeline_policy_;
+	float merge_distance_;
+
+	bool dedup_enabled_;
+	float dedup_translation_;
+	float dedup_rotation_;
+	float dedup_overlap_;
+	unsigned int dedup_depth_;
+	unsigned int dedup_max_skipped_;
 };
 }  // namespace ufomap_mapping
 
@@ -4,7 +4,12 @@
 #include <ufomap_msgs/conversions.h>
 #include <ufomap_ros/conversions.h>
 
-#include <future>
+#include <std_msgs/Float64MultiArray.h>
+#include <ufomap/radix_sort.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
 
 namespace ufomap_mapping
 {
@@ -19,15 +24,30 @@ UFOMapServer::UFOMapServer(ros::NodeHandle& nh, ros::NodeHandle& nh_priv)
 	, cloud_pub_(nh_priv.advertise<sensor_msgs::PointCloud2>(
 				"map_cloud", nh_priv.param("map_cloud_queue_size", 10),
 				nh_priv.param("map_cloud_latch", false)))
+	, pipeline_stats_pub_(
+				nh_priv.advertise<std_msgs::Float64MultiArray>("pipeline_stats", 10))
 	, tf_listener_(tf_buffer_)
 	, cs_(nh_priv)
 	, map_(nh_priv.param("resolution", 0.1), nh_priv.param("depth_levels", 16),
 				 !nh_priv.param("multithreaded", false))
+	, conversion_queue_(nh_priv.param("pipeline_queue_size", 2))
+	, transform_queue_(nh_priv.param("pipeline_queue_size", 2))
+	, integration_queue_(nh_priv.param("pipeline_queue_size", 2))
 {
+	if (nh_priv.param("multithreaded", false))
+	{
+		// Clouds can be integrated while the map is being published
+		map_.enableConcurrency();
+	}
+
 	// Set up dynamic reconfigure server
 	f_ = boost::bind(&UFOMapServer::configCallback, this, _1, _2);
 	cs_.setCallback(f_);
 
+	conversion_thread_ = std::thread(&UFOMapServer::conversionWorker, this);
+	transform_thread_ = std::thread(&UFOMapServer::transformWorker, this);
+	integration_thread_ = std::thread(&UFOMapServer::integrationWorker, this);
+
 	cloud_sub_ = nh.subscribe("cloud_in", nh_priv.param("cloud_in_queue_size", 10),
 														&UFOMapServer::cloudCallback, this);
 
@@ -40,54 +60,317 @@ UFOMapServer::UFOMapServer(ros::NodeHandle& nh, ros::NodeHandle& nh_priv)
 	// TODO: Enable services
 }
 
+UFOMapServer::~UFOMapServer()
+{
+	cloud_sub_.shutdown();
+	// Each worker closes the queue of the next stage when it is done
+	conversion_queue_.close();
+	if (conversion_thread_.joinable())
+	{
+		conversion_thread_.join();
+	}
+	if (transform_thread_.joinable())
+	{
+		transform_thread_.join();
+	}
+	if (integration_thread_.joinable())
+	{
+		integration_thread_.join();
+	}
+}
+
 // Private functions
 void UFOMapServer::cloudCallback(const sensor_msgs::PointCloud2::ConstPtr& msg)
 {
-	try
+	// Only hand the cloud over, so the subscriber queue never backs up
+	QueuePolicy policy;
 	{
-		ufomap::PointCloud cloud;
+		std::lock_guard<std::mutex> lock(config_mutex_);
+		policy = pipeline_policy_;
+	}
+
+	RawCloud raw;
+	raw.msg = msg;
+	raw.received = ros::WallTime::now();
+	raw.enqueued = raw.received;
+	conversion_stats_.dropped += conversion_queue_.push(std::move(raw), policy);
+}
+
+void UFOMapServer::conversionWorker()
+{
+	RawCloud raw;
+	while (conversion_queue_.pop(raw))
+	{
+		ConvertedCloud converted;
+		converted.header = raw.msg->header;
+		ufomap::toUfomap(raw.msg, converted.cloud);
+		converted.received = raw.received;
+		raw.msg.reset();
 
-		// auto a1 and a2 are same as:
-		// geometry_msgs::TransformStamped tmp_transform =
-		// tf_buffer_.lookupTransform(frame_id_, msg->header.frame_id, msg->header.stamp,
-		// transform_timeout_);
-		// ufomap::toUfomap(msg, cloud);
-
-		auto a1 = std::async(std::launch::async, [this, &msg] {
-			return tf_buffer_.lookupTransform(frame_id_, msg->header.frame_id,
-																				msg->header.stamp, transform_timeout_);
-		});
-		auto a2 =
-				std::async(std::launch::async, [&msg, &cloud] { ufomap::toUfomap(msg, cloud); });
-
-		ufomap_math::Pose6 transform = ufomap::toUfomap(a1.get().transform);
-		a2.wait();
-		cloud.transform(transform);
-		if (insert_discrete_)
+		QueuePolicy policy;
 		{
-			map_.insertPointCloudDiscrete(transform.translation(), cloud, max_range_, insert_n_,
-																		insert_depth_);
+			std::lock_guard<std::mutex> lock(config_mutex_);
+			policy = pipeline_policy_;
+		}
+
+		converted.enqueued = ros::WallTime::now();
+		conversion_stats_.latency = (converted.enqueued - raw.enqueued).toSec();
+		transform_stats_.dropped += transform_queue_.push(std::move(converted), policy);
+	}
+	transform_queue_.close();
+}
+
+void UFOMapServer::transformWorker()
+{
+	ConvertedCloud converted;
+	while (transform_queue_.pop(converted))
+	{
+		std::string frame_id;
+		ros::Duration transform_timeout;
+		QueuePolicy policy;
+		float merge_distance;
+		{
+			std::lock_guard<std::mutex> lock(config_mutex_);
+			frame_id = frame_id_;
+			transform_timeout = transform_timeout_;
+			policy = pipeline_policy_;
+			merge_distance = merge_distance_;
+		}
+
+		TransformedCloud transformed;
+		try
+		{
+			transformed.transform = ufomap::toUfomap(
+					tf_buffer_
+							.lookupTransform(frame_id, converted.header.frame_id,
+															 converted.header.stamp, transform_timeout)
+							.transform);
+		}
+		catch (tf2::TransformException& ex)
+		{
+			ROS_WARN_THROTTLE(1, "%s", ex.what());
+			++transform_stats_.dropped;
+			continue;
+		}
+
+		transformed.cloud = std::move(converted.cloud);
+		transformed.cloud.transform(transformed.transform);
+		transformed.received = converted.received;
+
+		transformed.enqueued = ros::WallTime::now();
+		transform_stats_.latency = (transformed.enqueued - converted.enqueued).toSec();
+		integration_stats_.dropped += integration_queue_.push(
+				std::move(transformed), policy,
+				[merge_distance](TransformedCloud& newest, TransformedCloud& cloud) {
+					return mergeClouds(newest, cloud, merge_distance);
+				});
+	}
+	integration_queue_.close();
+}
+
+void UFOMapServer::integrationWorker()
+{
+	TransformedCloud transformed;
+	while (integration_queue_.pop(transformed))
+	{
+		float max_range;
+		bool insert_discrete;
+		unsigned int insert_depth;
+		unsigned int insert_n;
+		bool clear_robot_enabled;
+		float robot_height;
+		float robot_radius;
+		bool dedup_enabled;
+		float dedup_translation;
+		float dedup_rotation;
+		float dedup_overlap;
+		unsigned int dedup_depth;
+		unsigned int dedup_max_skipped;
+		{
+			std::lock_guard<std::mutex> lock(config_mutex_);
+			max_range = max_range_;
+			insert_discrete = insert_discrete_;
+			insert_depth = insert_depth_;
+			insert_n = insert_n_;
+			clear_robot_enabled = clear_robot_enabled_;
+			robot_height = robot_height_;
+			robot_radius = robot_radius_;
+			dedup_enabled = dedup_enabled_;
+			dedup_translation = dedup_translation_;
+			dedup_rotation = dedup_rotation_;
+			dedup_overlap = dedup_overlap_;
+			dedup_depth = dedup_depth_;
+			dedup_max_skipped = dedup_max_skipped_;
+		}
+
+		const ufomap_math::Pose6& transform = transformed.transform;
+
+		if (dedup_enabled)
+		{
+			// A parked robot keeps sending the same scan, which would only burn a core
+			computeEndpointCodes(transformed, max_range, dedup_depth, scan_codes_);
+			if (isDuplicateScan(transform, scan_codes_, dedup_translation, dedup_rotation,
+													dedup_overlap) &&
+					(0 == dedup_max_skipped || num_duplicates_in_row_ < dedup_max_skipped))
+			{
+				++num_duplicates_in_row_;
+				++duplicates_skipped_;
+				integration_stats_.latency = (ros::WallTime::now() - transformed.enqueued).toSec();
+				continue;
+			}
+
+			// Later clouds are compared against this one
+			has_last_scan_ = true;
+			last_scan_transform_ = transform;
+			last_scan_codes_.swap(scan_codes_);
+			num_duplicates_in_row_ = 0;
 		}
 		else
 		{
-			map_.insertPointCloud(transform.translation(), cloud, max_range_);
+			has_last_scan_ = false;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(map_mutex_, std::defer_lock);
+			if (!map_.isConcurrencyEnabled())
+			{
+				lock.lock();
+			}
+
+			if (insert_discrete)
+			{
+				map_.insertPointCloudDiscrete(transform.translation(), transformed.cloud,
+																			max_range, insert_n, insert_depth);
+			}
+			else
+			{
+				map_.insertPointCloud(transform.translation(), transformed.cloud, max_range);
+			}
+
+			if (clear_robot_enabled)
+			{
+				ufomap::Point3 robot_bbx_min(transform.x() - robot_radius,
+																		 transform.y() - robot_radius,
+																		 transform.z() - (robot_height / 2.0));
+				ufomap::Point3 robot_bbx_max(transform.x() + robot_radius,
+																		 transform.y() + robot_radius,
+																		 transform.z() + (robot_height / 2.0));
+				map_.clearAreaBBX(robot_bbx_min, robot_bbx_max, 0);
+			}
 		}
 
-		if (clear_robot_enabled_)
+		ros::WallTime now = ros::WallTime::now();
+		integration_stats_.latency = (now - transformed.enqueued).toSec();
+		total_latency_ = (now - transformed.received).toSec();
+	}
+}
+
+void UFOMapServer::computeEndpointCodes(const TransformedCloud& transformed,
+																			 float max_range, unsigned int depth,
+																			 std::vector<uint64_t>& codes)
+{
+	// Same points as are integrated as hits
+	ufomap::Point3 origin = transformed.transform.translation();
+	codes.clear();
+	codes.reserve(transformed.cloud.size());
+	for (const ufomap::Point3& point : transformed.cloud)
+	{
+		if (0 > max_range || (point - origin).norm() < max_range)
 		{
-			ufomap::Point3 robot_bbx_min(transform.x() - robot_radius_,
-																	 transform.y() - robot_radius_,
-																	 transform.z() - (robot_height_ / 2.0));
-			ufomap::Point3 robot_bbx_max(transform.x() + robot_radius_,
-																	 transform.y() + robot_radius_,
-																	 transform.z() + (robot_height_ / 2.0));
-			map_.clearAreaBBX(robot_bbx_min, robot_bbx_max, 0);
+			codes.push_back(ufomap::Code(map_.coordToKey(point, depth)).getCode());
 		}
 	}
-	catch (tf2::TransformException& ex)
+	ufomap::radixSortUnique(codes, scan_codes_buffer_, 3 * map_.getTreeDepthLevels());
+}
+
+bool UFOMapServer::isDuplicateScan(const ufomap_math::Pose6& transform,
+																	 const std::vector<uint64_t>& codes,
+																	 float max_translation, float max_rotation,
+																	 float min_overlap) const
+{
+	if (!has_last_scan_ || max_translation < transform.translation().distance(
+																							 last_scan_transform_.translation()))
 	{
-		ROS_WARN_THROTTLE(1, "%s", ex.what());
+		return false;
+	}
+
+	// Angle of the rotation between the two orientations
+	ufomap_math::Quaternion q_1 = transform.rotation();
+	ufomap_math::Quaternion q_2 = last_scan_transform_.rotation();
+	float dot = std::fabs((q_1.w() * q_2.w()) + (q_1.x() * q_2.x()) +
+												(q_1.y() * q_2.y()) + (q_1.z() * q_2.z()));
+	if (max_rotation < 2.0 * std::acos(std::min(dot, 1.0f)))
+	{
+		return false;
+	}
+
+	// Fraction of the endpoint voxels that both clouds have, both are sorted
+	size_t num_common = 0;
+	auto it_1 = codes.cbegin();
+	auto it_2 = last_scan_codes_.cbegin();
+	while (codes.cend() != it_1 && last_scan_codes_.cend() != it_2)
+	{
+		if (*it_1 < *it_2)
+		{
+			++it_1;
+		}
+		else if (*it_2 < *it_1)
+		{
+			++it_2;
+		}
+		else
+		{
+			++num_common;
+			++it_1;
+			++it_2;
+		}
 	}
+	size_t num = std::max(codes.size(), last_scan_codes_.size());
+	return 0 == num || min_overlap * num <= num_common;
+}
+
+bool UFOMapServer::mergeClouds(TransformedCloud& newest, TransformedCloud& cloud,
+															 float max_distance)
+{
+	// The rays are cast from the sensor origin, so only clouds taken from about the same
+	// place can be integrated as one
+	if (max_distance <
+			newest.transform.translation().distance(cloud.transform.translation()))
+	{
+		return false;
+	}
+
+	newest.cloud.push_back(cloud.cloud);
+	newest.transform = cloud.transform;
+	return true;
+}
+
+void UFOMapServer::publishPipelineStats()
+{
+	// One row per stage (conversion, transform, integration) with the columns queue
+	// depth, latency (s) and number of dropped clouds. Last elements are the total latency
+	// (s) and the number of clouds skipped as duplicates of the last integrated cloud
+	std_msgs::Float64MultiArray msg;
+	msg.layout.dim.resize(2);
+	msg.layout.dim[0].label = "stage";
+	msg.layout.dim[0].size = 3;
+	msg.layout.dim[0].stride = 9;
+	msg.layout.dim[1].label = "queue_depth_latency_dropped";
+	msg.layout.dim[1].size = 3;
+	msg.layout.dim[1].stride = 3;
+
+	auto add = [&msg](const auto& queue, const StageStats& stats) {
+		msg.data.push_back(queue.size());
+		msg.data.push_back(stats.latency);
+		msg.data.push_back(stats.dropped);
+	};
+	add(conversion_queue_, conversion_stats_);
+	add(transform_queue_, transform_stats_);
+	add(integration_queue_, integration_stats_);
+	msg.data.push_back(total_latency_);
+	msg.data.push_back(duplicates_skipped_);
+
+	pipeline_stats_pub_.publish(msg);
 }
 
 void UFOMapServer::timerCallback(const ros::TimerEvent& event)
@@ -96,10 +379,28 @@ void UFOMapServer::timerCallback(const ros::TimerEvent& event)
 	header.stamp = ros::Time::now();
 	header.frame_id = frame_id_;
 
+	if (0 < pipeline_stats_pub_.getNumSubscribers())
+	{
+		publishPipelineStats();
+	}
+
+	std::unique_lock<std::mutex> lock(map_mutex_, std::defer_lock);
+	std::shared_ptr<const ufomap::Octree> snapshot;
+	if (map_.isConcurrencyEnabled())
+	{
+		// Reading map_ while clouds are integrated is not safe, publish a frozen copy
+		snapshot = map_.snapshot();
+	}
+	else
+	{
+		lock.lock();
+	}
+	const ufomap::Octree& map = snapshot ? *snapshot : map_;
+
 	if (0 < map_pub_.getNumSubscribers() || map_pub_.isLatched())
 	{
 		ufomap_msgs::Ufomap msg;
-		ufomap_msgs::mapToMsg(map_, msg, false);
+		ufomap_msgs::mapToMsg(map, msg, false);
 		msg.header = header;
 		map_pub_.publish(msg);
 	}
@@ -107,7 +408,7 @@ void UFOMapServer::timerCallback(const ros::TimerEvent& event)
 	if (0 < map_binary_pub_.getNumSubscribers() || map_binary_pub_.isLatched())
 	{
 		ufomap_msgs::Ufomap msg;
-		ufomap_msgs::mapToMsg(map_, msg, false, true);
+		ufomap_msgs::mapToMsg(map, msg, false, true);
 		msg.header = header;
 		map_binary_pub_.publish(msg);
 	}
@@ -115,8 +416,8 @@ void UFOMapServer::timerCallback(const ros::TimerEvent& event)
 	if (0 < cloud_pub_.getNumSubscribers() || cloud_pub_.isLatched())
 	{
 		ufomap::PointCloud cloud;
-		for (auto it = map_.begin_leafs(true, false, false, false, 0),
-							it_end = map_.end_leafs();
+		for (auto it = map.begin_leafs(true, false, false, false, 0),
+							it_end = map.end_leafs();
 				 it != it_end; ++it)
 		{
 			cloud.push_back(it.getCenter());
@@ -130,12 +431,18 @@ void UFOMapServer::timerCallback(const ros::TimerEvent& event)
 
 void UFOMapServer::configCallback(ufomap_mapping::ServerConfig& config, uint32_t level)
 {
+	std::lock_guard<std::mutex> config_lock(config_mutex_);
+
 	frame_id_ = config.frame_id;
 	max_range_ = config.max_range;
 	insert_discrete_ = config.insert_discrete;
 	insert_depth_ = config.insert_depth;
 	insert_n_ = config.insert_n;
 	clear_robot_enabled_ = config.clear_robot;
+	{
+		std::lock_guard<std::mutex> map_lock(map_mutex_);
+		map_.setNumThreads(config.num_threads);
+	}
 	robot_height_ = config.robot_height;
 	robot_radius_ = config.robot_radius;
 
@@ -151,6 +458,19 @@ void UFOMapServer::configCallback(ufomap_mapping::ServerConfig& config, uint32_t
 
 	transform_timeout_.fromSec(config.transform_timeout);
 
+	pipeline_policy_ = static_cast<QueuePolicy>(config.pipeline_policy);
+	merge_distance_ = config.merge_distance;
+
+	dedup_enabled_ = config.dedup_enabled;
+	dedup_translation_ = config.dedup_translation;
+	dedup_rotation_ = config.dedup_rotation;
+	dedup_overlap_ = config.dedup_overlap;
+	dedup_depth_ = config.dedup_depth;
+	dedup_max_skipped_ = config.dedup_max_skipped;
+	conversion_stats_.dropped += conversion_queue_.setCapacity(config.pipeline_queue_size);
+	transform_stats_.dropped += transform_queue_.setCapacity(config.pipeline_queue_size);
+	integration_stats_.dropped += integration_queue_.setCapacity(config.pipeline_queue_size);
+
 	if (cloud_in_queue_size_ != config.cloud_in_queue_size)
 	{
 		cloud_sub_ = nh_.subscribe("cloud_in", config.cloud_in_queue_size,